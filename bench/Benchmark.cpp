@@ -0,0 +1,678 @@
+// bench/Benchmark.cpp
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <memory>
+#include <string>
+#include <thread>
+#include "ErrorTree.hpp"
+#include "ImageIO.hpp"
+#include "ImageCompressor.hpp"
+#include "ImageQuality.hpp"
+#include "MetricKernels.hpp"
+#include "QoiCodec.hpp"
+#include "QuadtreeBuilder.hpp"
+#include "QuadtreeRefiner.hpp"
+#include "RateDistortionPruner.hpp"
+#include "SizeEstimator.hpp"
+#include "StripReader.hpp"
+#include "stb_image.h"
+#include "stb_image_write.h"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#define PSAPI_VERSION 2 // GetProcessMemoryInfo from kernel32, so nothing more to link
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
+using Clock = std::chrono::steady_clock;
+
+// Keeps timed results observable so the loops are not optimized away
+static volatile double resultSink;
+
+struct Tables {
+    IntegralImage integral;
+    HistogramPyramid histograms;
+    MinMaxPyramid ranges;
+    MetricSource source;
+
+    explicit Tables(const Image& pixels) {
+        integral.build(pixels);
+        histograms.build(pixels);
+        ranges.build(pixels);
+        source.pixels = &pixels;
+        source.integral = &integral;
+        source.histograms = &histograms;
+        source.ranges = &ranges;
+    }
+};
+
+// Every equivalence a mode checks goes through check, and any that fails fails the run
+static int mismatches = 0;
+
+static const char* check(bool same) {
+    if (!same) ++mismatches;
+    return same ? "" : " MISMATCH";
+}
+
+// The image argument of a mode, loaded, or false after printing the mode's usage
+static bool loadArg(int argc, char** argv, const char* usage, Image& pixels) {
+    if (argc < 3) {
+        std::cerr << "usage: bench " << usage << "\n";
+        return false;
+    }
+    return ImageIO::loadImage(argv[2], pixels);
+}
+
+// The scaffold of the modes that compare per metric: the image and its tables, a
+// line naming them, then compare(name, metric, threshold, tables, pixels) for each
+// metric at a threshold typical of it, times scale
+template <typename Compare>
+static int perMetric(int argc, char** argv, const char* usage, Compare compare, double scale = 1.0,
+                     const std::string& note = "") {
+    Image pixels;
+    if (!loadArg(argc, argv, usage, pixels)) return EXIT_FAILURE;
+    Tables tables(pixels);
+
+    std::cout << argv[2] << " (" << pixels.getWidth() << "x" << pixels.getHeight() << note << ")\n";
+    compare("variance", VarianceMetric(), 50 * scale, tables, pixels);
+    compare("mad", MadMetric(), 8 * scale, tables, pixels);
+    compare("maxdiff", MaxDifferenceMetric(), 30 * scale, tables, pixels);
+    compare("entropy", EntropyMetric(), 3 * scale, tables, pixels);
+    compare("ssim", SsimMetric(), 0.05 * scale, tables, pixels);
+    return EXIT_SUCCESS;
+}
+
+// Best of `repeats` runs of a full build, in nanoseconds per node
+template <typename Metric>
+static double timeBuild(const Metric& metric, const MetricSource& source, int width, int height,
+                        double threshold, int minBlock, int repeats, int& nodes) {
+    QuadtreeBuilder<Metric> builder(metric, threshold, minBlock);
+    double best = 1e300;
+    for (int r = 0; r < repeats; ++r) {
+        auto start = Clock::now();
+        std::unique_ptr<Quadtree> tree(builder.build(source, width, height));
+        double ns = std::chrono::duration<double, std::nano>(Clock::now() - start).count();
+        nodes = tree->countNodes();
+        best = std::min(best, ns);
+    }
+    return best / nodes;
+}
+
+struct Rect {
+    int x, y, width, height;
+};
+
+static std::vector<Rect> collectRects(const Quadtree& tree) {
+    std::vector<Rect> rects;
+    for (const QuadtreeNode& node : tree.getNodes())
+        rects.push_back({node.x, node.y, node.width, node.height});
+    return rects;
+}
+
+// Metric calls alone over the nodes of a built tree, without the allocation noise of build
+template <typename Metric>
+static double timeEvaluations(const Metric& metric, const MetricSource& source, const std::vector<Rect>& rects, int repeats) {
+    double best = 1e300;
+    for (int r = 0; r < repeats; ++r) {
+        auto start = Clock::now();
+        double total = 0.0;
+        for (const Rect& rect : rects)
+            total += metric(source, rect.x, rect.y, rect.width, rect.height).error;
+        resultSink = total;
+        best = std::min(best, std::chrono::duration<double, std::nano>(Clock::now() - start).count());
+    }
+    return best / rects.size();
+}
+
+template <typename Metric>
+static void compareDispatch(const char* name, const Metric& metric, const Tables& tables, int width, int height,
+                            double threshold, int minBlock, int repeats) {
+    int nodes = 0;
+    double direct = timeBuild(metric, tables.source, width, height, threshold, minBlock, repeats, nodes);
+    double dynamic = timeBuild(DynamicMetric{metric}, tables.source, width, height, threshold, minBlock, repeats, nodes);
+
+    QuadtreeBuilder<Metric> builder(metric, threshold, minBlock);
+    std::unique_ptr<Quadtree> tree(builder.build(tables.source, width, height));
+    std::vector<Rect> rects = collectRects(*tree);
+    double directEval = timeEvaluations(metric, tables.source, rects, repeats);
+    double dynamicEval = timeEvaluations(DynamicMetric{metric}, tables.source, rects, repeats);
+
+    std::cout << name << "\t" << nodes << " nodes"
+              << "\tbuild: template " << direct << " / std::function " << dynamic << " ns/node"
+              << "\tmetric calls: template " << directEval << " / std::function " << dynamicEval
+              << " ns/node (" << dynamicEval - directEval << " ns overhead)\n";
+}
+
+// Per-node cost of the templated build against the std::function path it replaced
+static int benchDispatch(int argc, char** argv) {
+    double scale = argc > 3 ? std::atof(argv[3]) : 1.0;
+    int minBlock = argc > 4 ? std::atoi(argv[4]) : 1;
+    int repeats = argc > 5 ? std::atoi(argv[5]) : 5;
+    return perMetric(argc, argv, "dispatch <image> [threshold-scale=1] [min-block=1] [repeats=5]",
+                     [&](const char* name, const auto& metric, double threshold, const Tables& tables, const Image& pixels) {
+                         compareDispatch(name, metric, tables, pixels.getWidth(), pixels.getHeight(), threshold,
+                                         minBlock, repeats);
+                     },
+                     scale);
+}
+
+// Both builds lay nodes out in preorder, so equal trees have equal arrays
+static bool sameTree(const Quadtree& a, const Quadtree& b) {
+    const std::vector<QuadtreeNode>& x = a.getNodes();
+    const std::vector<QuadtreeNode>& y = b.getNodes();
+    if (x.size() != y.size()) return false;
+    for (size_t i = 0; i < x.size(); ++i) {
+        const QuadtreeNode& p = x[i];
+        const QuadtreeNode& q = y[i];
+        if (p.x != q.x || p.y != q.y || p.width != q.width || p.height != q.height || p.is_leaf != q.is_leaf ||
+            p.color.r != q.color.r || p.color.g != q.color.g || p.color.b != q.color.b ||
+            !std::equal(p.children, p.children + 4, q.children))
+            return false;
+    }
+    return true;
+}
+
+template <typename Metric>
+static void scaleThreads(const char* name, const Metric& metric, const MetricSource& source, int width, int height,
+                         double threshold, int minBlock, int maxThreads, int repeats) {
+    QuadtreeBuilder<Metric> serial(metric, threshold, minBlock);
+    std::unique_ptr<Quadtree> reference(serial.build(source, width, height));
+
+    std::cout << name << "\t" << reference->countNodes() << " nodes";
+    double base = 0.0;
+    for (int threads = 1; threads <= maxThreads; threads *= 2) {
+        ThreadPool pool(threads);
+        QuadtreeBuilder<Metric> builder(metric, threshold, minBlock);
+        CompressorOptions defaults;
+        builder.setParallel(&pool, defaults.parallelMinArea, defaults.parallelMaxDepth);
+
+        double best = 1e300;
+        bool identical = true;
+        for (int r = 0; r < repeats; ++r) {
+            auto start = Clock::now();
+            std::unique_ptr<Quadtree> tree(builder.build(source, width, height));
+            best = std::min(best, std::chrono::duration<double, std::milli>(Clock::now() - start).count());
+            identical = identical && sameTree(*tree, *reference);
+        }
+        if (threads == 1) base = best;
+        std::cout << "\t" << threads << "T " << best << " ms (x" << base / best << ")" << check(identical);
+    }
+    std::cout << "\n";
+}
+
+// Build time against thread count, checking every parallel tree against the serial one
+static int benchThreads(int argc, char** argv) {
+    int maxThreads = argc > 3 ? std::atoi(argv[3]) : static_cast<int>(std::thread::hardware_concurrency());
+    int minBlock = argc > 4 ? std::atoi(argv[4]) : 1;
+    int repeats = argc > 5 ? std::atoi(argv[5]) : 3;
+    return perMetric(argc, argv, "threads <image> [max-threads=hardware] [min-block=1] [repeats=3]",
+                     [&](const char* name, const auto& metric, double threshold, const Tables& tables, const Image& pixels) {
+                         scaleThreads(name, metric, tables.source, pixels.getWidth(), pixels.getHeight(), threshold,
+                                      minBlock, maxThreads, repeats);
+                     },
+                     1.0, ", " + std::to_string(std::thread::hardware_concurrency()) + " hardware threads");
+}
+
+// PSNR of a rendered tree against the original, computed directly from the pixels
+static double renderedPsnr(const Quadtree& tree, const Image& pixels) {
+    Image rendered = tree.renderToPixels();
+    double error = 0.0;
+    for (int y = 0; y < pixels.getHeight(); ++y)
+        for (int x = 0; x < 3 * pixels.getWidth(); ++x) {
+            double d = static_cast<double>(pixels.row(y)[x]) - rendered.row(y)[x];
+            error += d * d;
+        }
+    double mse = error / (3.0 * pixels.getWidth() * pixels.getHeight());
+    return 10.0 * std::log10(255.0 * 255.0 / mse);
+}
+
+template <typename Metric>
+static void compareSweep(const char* name, const Metric& metric, const Tables& tables, const Image& pixels,
+                         double threshold, int minBlock) {
+    const int width = pixels.getWidth(), height = pixels.getHeight();
+    std::vector<double> thresholds;
+    for (double scale : {0.25, 0.5, 1.0, 2.0, 4.0, 8.0})
+        thresholds.push_back(threshold * scale);
+
+    auto start = Clock::now();
+    QuadtreeBuilder<Metric> full(metric, -std::numeric_limits<double>::infinity(), minBlock);
+    ErrorTree errorTree(full.build(tables.source, width, height), pixels);
+    double buildMs = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+
+    start = Clock::now();
+    std::vector<SweepPoint> points = errorTree.sweep(thresholds);
+    double sweepMs = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+
+    start = Clock::now();
+    RateDistortionPruner pruner(errorTree);
+    double prunerMs = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+
+    std::cout << name << "\terror tree " << errorTree.getFull().countNodes() << " nodes in " << buildMs
+              << " ms, sweep of " << thresholds.size() << " thresholds in " << sweepMs << " ms, rate-distortion curve of "
+              << pruner.curve().size() << " points in " << prunerMs << " ms\n";
+    for (const SweepPoint& point : points) {
+        start = Clock::now();
+        std::unique_ptr<Quadtree> cut(errorTree.cut(point.threshold));
+        double cutMs = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+
+        start = Clock::now();
+        QuadtreeBuilder<Metric> builder(metric, point.threshold, minBlock);
+        std::unique_ptr<Quadtree> rebuilt(builder.build(tables.source, width, height));
+        double rebuildMs = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+
+        std::cout << "\tthreshold " << point.threshold << "\t" << point.leaves << " leaves\tPSNR " << point.psnr
+                  << " (rendered " << renderedPsnr(*cut, pixels) << ")\tcut " << cutMs << " ms / rebuild "
+                  << rebuildMs << " ms" << check(sameTree(*cut, *rebuilt) && cut->countNodes() == point.nodes)
+                  << "\n";
+
+        // The optimal tree for the same size estimate
+        const RatePoint& best = pruner.pointForBytes(point.estimatedBytes);
+        std::unique_ptr<Quadtree> pruned(pruner.pruneToBytes(point.estimatedBytes));
+        std::cout << "\t  pruned to " << point.estimatedBytes / 1024.0 << " KB\t" << best.leaves << " leaves\tPSNR "
+                  << 10.0 * std::log10(255.0 * 255.0 * 3 * width * height / best.squaredError) << " (rendered "
+                  << renderedPsnr(*pruned, pixels) << ")"
+                  << check(pruned->countNodes() == best.nodes) << "\n";
+    }
+}
+
+// One build down to the minimum block size, then thresholds as cuts, against rebuilding each
+static int benchSweep(int argc, char** argv) {
+    int minBlock = argc > 3 ? std::atoi(argv[3]) : 1;
+    return perMetric(argc, argv, "sweep <image> [min-block=1]",
+                     [&](const char* name, const auto& metric, double threshold, const Tables& tables, const Image& pixels) {
+                         compareSweep(name, metric, tables, pixels, threshold, minBlock);
+                     });
+}
+
+// Walks a bisection-like sequence of thresholds by refinement and by rebuilding
+template <typename Metric>
+static void compareRefine(const char* name, const Metric& metric, const Tables& tables, const Image& pixels,
+                          double threshold, int minBlock) {
+    const int width = pixels.getWidth(), height = pixels.getHeight();
+    const double sequence[] = {threshold, threshold * 2, threshold * 1.5, threshold * 1.75, threshold * 1.625,
+                               threshold * 1.6875, threshold * 1.65625, threshold * 0.5, threshold * 4};
+
+    QuadtreeBuilder<Metric> first(metric, sequence[0], minBlock);
+    std::unique_ptr<Quadtree> initial(first.build(tables.source, width, height));
+    QuadtreeRefiner<Metric> refiner(metric, tables.source, *initial, minBlock, sequence[0]);
+
+    std::cout << name << "\n";
+    for (double t : sequence) {
+        auto start = Clock::now();
+        refiner.setThreshold(t);
+        double refineMs = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+        std::unique_ptr<Quadtree> refined(refiner.snapshot());
+        double snapshotMs = std::chrono::duration<double, std::milli>(Clock::now() - start).count() - refineMs;
+
+        start = Clock::now();
+        QuadtreeBuilder<Metric> builder(metric, t, minBlock);
+        std::unique_ptr<Quadtree> rebuilt(builder.build(tables.source, width, height));
+        double rebuildMs = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+
+        std::cout << "\tthreshold " << t << "\t" << refined->countNodes() << " nodes, " << refiner.changedNodes()
+                  << " changed\trefine " << refineMs << " ms + snapshot " << snapshotMs << " ms / rebuild " << rebuildMs
+                  << " ms" << check(sameTree(*refined, *rebuilt)) << "\n";
+    }
+}
+
+// The size model against the real encoder over a range of thresholds: raw, and
+// calibrated on the encode at the previous threshold (twice smaller), as the
+// target search would have it
+template <typename Metric>
+static void compareEstimate(const char* name, const Metric& metric, const Tables& tables, const Image& pixels,
+                            double threshold, int minBlock) {
+    const int width = pixels.getWidth(), height = pixels.getHeight();
+    QuadtreeBuilder<Metric> full(metric, -std::numeric_limits<double>::infinity(), minBlock);
+    ErrorTree errorTree(full.build(tables.source, width, height), pixels);
+
+    std::cout << name << "\n";
+    double rawError = 0, calibratedError = 0;
+    int rows = 0;
+    SizeEstimator previous;
+    for (double scale : {0.125, 0.25, 0.5, 1.0, 2.0, 4.0, 8.0, 16.0}) {
+        std::unique_ptr<Quadtree> tree(errorTree.cut(threshold * scale));
+
+        auto start = Clock::now();
+        TreeStats stats = SizeEstimator::stats(*tree);
+        double modelled = SizeEstimator::model(stats);
+        double calibrated = previous.predict(stats);
+        double estimateMs = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+
+        start = Clock::now();
+        int64_t real = ImageIO::encodedSize(tree.get());
+        double encodeMs = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+
+        double raw = modelled / real - 1, fitted = calibrated / real - 1;
+        std::cout << "\tthreshold " << threshold * scale << "\t" << stats.leaves << " leaves\treal " << real / 1024.0
+                  << " KB\tmodel " << raw * 100 << "%\tcalibrated " << (scale == 0.125 ? 0.0 : fitted * 100)
+                  << "%\testimate " << estimateMs << " ms / encode " << encodeMs << " ms\n";
+        rawError += std::abs(raw);
+        if (scale != 0.125) calibratedError += std::abs(fitted), ++rows;
+
+        previous = SizeEstimator();
+        previous.calibrate(*tree, real);
+    }
+    std::cout << "\tmean error: model " << rawError / 8 * 100 << "%, calibrated " << calibratedError / rows * 100 << "%\n";
+}
+
+// How far the size estimate used by the target search is from the real encoder
+static int benchEstimate(int argc, char** argv) {
+    int minBlock = argc > 3 ? std::atoi(argv[3]) : 1;
+    return perMetric(argc, argv, "estimate <image> [min-block=1]",
+                     [&](const char* name, const auto& metric, double threshold, const Tables& tables, const Image& pixels) {
+                         compareEstimate(name, metric, tables, pixels, threshold, minBlock);
+                     });
+}
+
+// Moving between nearby thresholds in place, against a fresh build for each
+static int benchRefine(int argc, char** argv) {
+    int minBlock = argc > 3 ? std::atoi(argv[3]) : 1;
+    return perMetric(argc, argv, "refine <image> [min-block=1]",
+                     [&](const char* name, const auto& metric, double threshold, const Tables& tables, const Image& pixels) {
+                         compareRefine(name, metric, tables, pixels, threshold, minBlock);
+                     });
+}
+
+// Windowed SSIM straight from its definition, per window in doubles
+static double directSsim(const Image& a, const Image& b) {
+    const int window = MetricKernels::SSIM_WINDOW;
+    const double C1 = 6.5025, C2 = 58.5225, n = window * window;
+    const double weights[3] = {0.2125, 0.7154, 0.0721};
+    double total = 0.0;
+    for (int y = 0; y + window <= a.getHeight(); ++y)
+        for (int x = 0; x + window <= a.getWidth(); ++x)
+            for (int ch = 0; ch < 3; ++ch) {
+                double sx = 0, sy = 0, sxx = 0, syy = 0, sxy = 0;
+                for (int j = y; j < y + window; ++j)
+                    for (int i = x; i < x + window; ++i) {
+                        double vx = a.pixel(i, j)[ch], vy = b.pixel(i, j)[ch];
+                        sx += vx, sy += vy, sxx += vx * vx, syy += vy * vy, sxy += vx * vy;
+                    }
+                double mx = sx / n, my = sy / n;
+                double varX = sxx / n - mx * mx, varY = syy / n - my * my, cov = sxy / n - mx * my;
+                total += weights[ch] * (2 * mx * my + C1) * (2 * cov + C2) / ((mx * mx + my * my + C1) * (varX + varY + C2));
+            }
+    double windows = static_cast<double>(a.getHeight() - window + 1) * (a.getWidth() - window + 1);
+    return total / windows / (weights[0] + weights[1] + weights[2]);
+}
+
+// Windowed SSIM of rendered trees against the original, on one thread and on all,
+// checked against the direct definition. tile > 1 repeats the image tile x tile times
+static int benchQuality(int argc, char** argv) {
+    int tile = argc > 3 ? std::max(1, std::atoi(argv[3])) : 1;
+    int repeats = argc > 4 ? std::max(1, std::atoi(argv[4])) : 3;
+
+    Image loaded;
+    if (!loadArg(argc, argv, "quality <image> [tile=1] [repeats=3]", loaded)) return EXIT_FAILURE;
+    Image pixels(loaded.getWidth() * tile, loaded.getHeight() * tile);
+    for (int y = 0; y < pixels.getHeight(); ++y)
+        for (int t = 0; t < tile; ++t)
+            std::copy(loaded.row(y % loaded.getHeight()), loaded.row(y % loaded.getHeight()) + 3 * loaded.getWidth(),
+                      pixels.row(y) + 3 * static_cast<size_t>(t) * loaded.getWidth());
+    Tables tables(pixels);
+
+    ThreadPool serial(1), parallel(0);
+    std::cout << argv[2] << " (" << pixels.getWidth() << "x" << pixels.getHeight() << ", "
+              << MetricKernels::active().name << ", " << parallel.size() << " threads)\n";
+    for (double threshold : {10.0, 50.0, 200.0}) {
+        QuadtreeBuilder<VarianceMetric> builder(VarianceMetric(), threshold, 1);
+        std::unique_ptr<Quadtree> tree(builder.build(tables.source, pixels.getWidth(), pixels.getHeight()));
+        Image rendered = tree->renderToPixels();
+
+        double ms[2] = {1e300, 1e300}, scores[2] = {0.0, 0.0};
+        ThreadPool* pools[2] = {&serial, &parallel};
+        for (int p = 0; p < 2; ++p)
+            for (int r = 0; r < repeats; ++r) {
+                auto start = Clock::now();
+                scores[p] = ImageQuality::ssim(pixels, rendered, pools[p]);
+                ms[p] = std::min(ms[p], std::chrono::duration<double, std::milli>(Clock::now() - start).count());
+            }
+
+        std::cout << "\tthreshold " << threshold << "\tSSIM " << scores[1] << "\t1 thread " << ms[0] << " ms / "
+                  << parallel.size() << " threads " << ms[1] << " ms" << check(scores[0] == scores[1]);
+        if (tile == 1) std::cout << "\tdirect " << directSsim(pixels, rendered);
+        std::cout << "\n";
+    }
+    return EXIT_SUCCESS;
+}
+
+// Peak resident set of the process so far: the peak working set on Windows
+static long peakKilobytes() {
+#ifdef _WIN32
+    PROCESS_MEMORY_COUNTERS counters;
+    if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) return 0;
+    return static_cast<long>(counters.PeakWorkingSetSize / 1024);
+#else
+    rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss;
+#endif
+}
+
+// Peak memory of a load that adopts the decoder's buffer, against copying it into
+// an image of its own as the loader used to. The peak only grows, so each path
+// gets a process of its own. The first pass over the pixels is timed as well: a
+// mapped file pays its page faults there instead of in the load.
+static int benchLoad(int argc, char** argv) {
+    if (argc < 4 || (std::strcmp(argv[3], "adopt") != 0 && std::strcmp(argv[3], "copy") != 0)) {
+        std::cerr << "usage: bench load <image> adopt|copy\n";
+        return EXIT_FAILURE;
+    }
+    const bool adopt = std::strcmp(argv[3], "adopt") == 0;
+    const long before = peakKilobytes();
+
+    auto start = Clock::now();
+    Image pixels;
+    if (adopt) {
+        if (!ImageIO::loadImage(argv[2], pixels)) return EXIT_FAILURE;
+    } else {
+        int width, height, channels;
+        unsigned char* data = stbi_load(argv[2], &width, &height, &channels, 3);
+        if (!data) return EXIT_FAILURE;
+        pixels = Image(width, height);
+        for (int y = 0; y < height; ++y)
+            std::memcpy(pixels.row(y), data + static_cast<size_t>(y) * width * 3, static_cast<size_t>(width) * 3);
+        stbi_image_free(data);
+    }
+    double ms = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+
+    start = Clock::now();
+    uint64_t checksum = 0;
+    for (int y = 0; y < pixels.getHeight(); ++y)
+        for (const uint8_t* p = pixels.row(y); p < pixels.row(y) + 3 * static_cast<size_t>(pixels.getWidth()); ++p)
+            checksum += *p;
+    double passMs = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+
+    const double imageKb = 3.0 * pixels.getWidth() * pixels.getHeight() / 1024.0;
+    std::cout << argv[2] << " (" << pixels.getWidth() << "x" << pixels.getHeight() << ")\t" << argv[3] << "\t"
+              << ms << " ms, first pass " << passMs << " ms (sum " << checksum << ")\tpeak +" << peakKilobytes() - before
+              << " KB (" << (peakKilobytes() - before) / imageKb << "x the pixels)\n";
+    return EXIT_SUCCESS;
+}
+
+// Best of `repeats` timings of fn, in milliseconds
+template <typename Fn>
+static double bestMs(int repeats, Fn fn) {
+    double best = 1e300;
+    for (int r = 0; r < repeats; ++r) {
+        auto start = Clock::now();
+        fn();
+        best = std::min(best, std::chrono::duration<double, std::milli>(Clock::now() - start).count());
+    }
+    return best;
+}
+
+static void compareCodecs(const char* name, const Image& image, int repeats) {
+    int64_t pngSize = 0;
+    double pngMs = bestMs(repeats, [&] {
+        pngSize = 0;
+        auto count = [](void* context, void*, int size) { *static_cast<int64_t*>(context) += size; };
+        stbi_write_png_to_func(count, &pngSize, image.getWidth(), image.getHeight(), 3, image.row(0),
+                               static_cast<int>(image.getStride()));
+    });
+    std::vector<uint8_t> qoi;
+    double qoiMs = bestMs(repeats, [&] { qoi = QoiCodec::encode(image); });
+    Image decoded;
+    double decodeMs = bestMs(repeats, [&] { QoiCodec::decode(qoi.data(), qoi.size(), decoded); });
+
+    bool same = decoded.getWidth() == image.getWidth() && decoded.getHeight() == image.getHeight();
+    for (int y = 0; same && y < image.getHeight(); ++y)
+        same = std::memcmp(decoded.row(y), image.row(y), 3 * static_cast<size_t>(image.getWidth())) == 0;
+
+    const double mb = 3.0 * image.getWidth() * image.getHeight() / 1048576.0;
+    std::cout << name << "\tpng " << pngSize / 1024.0 << " KB in " << pngMs << " ms (" << mb / pngMs * 1000 << " MB/s)"
+              << "\tqoi " << qoi.size() / 1024.0 << " KB in " << qoiMs << " ms (" << mb / qoiMs * 1000 << " MB/s), decode "
+              << decodeMs << " ms" << check(same) << "\n";
+}
+
+// PNG against QOI on an image and on a quadtree render of it: size, encode speed,
+// and a QOI round trip
+static int benchCodecs(int argc, char** argv) {
+    double threshold = argc > 3 ? std::atof(argv[3]) : 50;
+    int minBlock = argc > 4 ? std::atoi(argv[4]) : 2;
+    int repeats = argc > 5 ? std::atoi(argv[5]) : 3;
+
+    Image pixels;
+    if (!loadArg(argc, argv, "codecs <image> [threshold=50] [min-block=2] [repeats=3]", pixels)) return EXIT_FAILURE;
+    Tables tables(pixels);
+    std::unique_ptr<Quadtree> tree(
+        QuadtreeBuilder<VarianceMetric>(VarianceMetric(), threshold, minBlock).build(tables.source, pixels.getWidth(), pixels.getHeight()));
+
+    std::cout << argv[2] << " (" << pixels.getWidth() << "x" << pixels.getHeight() << "), variance " << threshold << ", "
+              << tree->countNodes() << " nodes\n";
+    compareCodecs("original", pixels, repeats);
+    compareCodecs("quadtree", tree->renderToPixels(), repeats);
+    return EXIT_SUCCESS;
+}
+
+// Writes bytes to a file under dir, with a sidecar beside it when one is given
+static std::string writeCase(const std::filesystem::path& dir, const std::string& name, const std::string& bytes,
+                             const std::string& sidecar = "") {
+    const std::string path = (dir / name).string();
+    std::ofstream(path, std::ios::binary) << bytes;
+    if (!sidecar.empty()) std::ofstream(path + ".hdr") << sidecar;
+    return path;
+}
+
+// Whether a loader's answer was the expected one, printed and counted like any mismatch
+static void expect(const char* loader, const std::string& what, bool loaded, bool valid) {
+    std::cout << "\t" << loader << " " << what << "\t" << (loaded ? "loaded" : "rejected") << check(loaded == valid)
+              << "\n";
+}
+
+// Headers that claim more than their file holds, or sizes that overflow, fed to the
+// three parsers that read them: ImageIO::mapImage, StripReader and QoiCodec::decode.
+// Each must turn them down without allocating or reading what they claim, and still
+// load the valid control beside them.
+static int benchHeaders(int argc, char** argv) {
+    std::error_code error;
+    const std::filesystem::path dir = std::filesystem::temp_directory_path(error) / "quadtree-bench-headers";
+    std::filesystem::create_directories(dir, error);
+    if (error) {
+        std::cerr << "cannot create " << dir.string() << ": " << error.message() << "\n";
+        return EXIT_FAILURE;
+    }
+
+    struct Case {
+        const char* what;
+        std::string path;
+        bool valid;
+    };
+    const std::string pixels(64, '\x80');
+    const std::vector<Case> files = {
+        {"valid 4x4 P6", writeCase(dir, "valid.ppm", "P6\n4 4\n255\n" + std::string(48, '\x80')), true},
+        {"valid 4x4 raw", writeCase(dir, "valid.rgb", std::string(48, '\x80'), "width 4\nheight 4\n"), true},
+        {"P6 2147483647x2147483647", writeCase(dir, "huge.ppm", "P6\n2147483647 2147483647\n255\n" + pixels), false},
+        {"P6 header only", writeCase(dir, "headeronly.ppm", "P6\n4 4\n255\n"), false},
+        {"P6 short of pixels", writeCase(dir, "short.ppm", "P6\n4 4\n255\n" + std::string(47, '\x80')), false},
+        {"PAM depth 9", writeCase(dir, "depth.pam", "P7\nWIDTH 2\nHEIGHT 2\nDEPTH 9\nMAXVAL 255\nENDHDR\n" + pixels),
+         false},
+        {"raw stride 186330748219288401",
+         writeCase(dir, "stride.rgb", pixels, "width 100\nheight 100\nstride 186330748219288401\n"), false},
+        {"raw width 9223372036854775807",
+         writeCase(dir, "width.rgb", pixels, "width 9223372036854775807\nheight 1\n"), false},
+        {"raw offset past the end", writeCase(dir, "offset.rgb", pixels, "width 4\nheight 4\noffset 32\n"), false},
+    };
+
+    std::cout << "hostile headers in " << dir.string() << "\n";
+    for (const Case& file : files) {
+        Image mapped;
+        expect("mapImage", file.what, ImageIO::mapImage(file.path, mapped), file.valid);
+        StripReader reader;
+        Image band;
+        expect("StripReader", file.what, reader.open(file.path) && reader.read(0, reader.getHeight(), band),
+               file.valid);
+    }
+
+    auto qoiHeader = [](uint32_t width, uint32_t height) {
+        std::string header = "qoif";
+        for (uint32_t value : {width, height})
+            for (int shift = 24; shift >= 0; shift -= 8) header += static_cast<char>(value >> shift);
+        return header + "\x03" + std::string(1, '\0');
+    };
+    const std::string end("\0\0\0\0\0\0\0\x01", 8);
+    const std::vector<uint8_t> control = QoiCodec::encode(Image(4, 4, Color(128, 64, 32)));
+    const std::vector<std::pair<std::string, std::string>> streams = {
+        {"valid 4x4", std::string(control.begin(), control.end())},
+        {"2147483647x2147483647", qoiHeader(0x7fffffff, 0x7fffffff) + end},
+        {"20000x20000 from 1000 bytes", qoiHeader(20000, 20000) + std::string(1000, '\xfd') + end},
+        // Passes the size check, as its index ops are one pixel a byte, but runs out mid-image
+        {"100x100 cut short", qoiHeader(100, 100) + std::string(150, '\xfd') + std::string(20, '\0') + end},
+        {"header cut short", qoiHeader(4, 4).substr(0, 10)},
+    };
+    for (const auto& [what, bytes] : streams) {
+        Image decoded;
+        expect("QoiCodec::decode", what,
+               QoiCodec::decode(reinterpret_cast<const uint8_t*>(bytes.data()), bytes.size(), decoded),
+               &what == &streams.front().first);
+    }
+
+    std::filesystem::remove_all(dir, error);
+    return EXIT_SUCCESS;
+}
+
+static int runMode(int argc, char** argv) {
+    std::string mode = argc > 1 ? argv[1] : "";
+    if (mode == "dispatch") return benchDispatch(argc, argv);
+    if (mode == "threads") return benchThreads(argc, argv);
+    if (mode == "sweep") return benchSweep(argc, argv);
+    if (mode == "refine") return benchRefine(argc, argv);
+    if (mode == "estimate") return benchEstimate(argc, argv);
+    if (mode == "quality") return benchQuality(argc, argv);
+    if (mode == "load") return benchLoad(argc, argv);
+    if (mode == "codecs") return benchCodecs(argc, argv);
+    if (mode == "headers") return benchHeaders(argc, argv);
+
+    std::cerr << "usage: bench <mode> ...\n"
+              << "  dispatch <image> [threshold-scale] [min-block] [repeats]\n"
+              << "  threads <image> [max-threads] [min-block] [repeats]\n"
+              << "  sweep <image> [min-block]\n"
+              << "  refine <image> [min-block]\n"
+              << "  estimate <image> [min-block]\n"
+              << "  quality <image> [tile] [repeats]\n"
+              << "  load <image> adopt|copy\n"
+              << "  codecs <image> [threshold] [min-block] [repeats]\n"
+              << "  headers\n";
+    return EXIT_FAILURE;
+}
+
+int main(int argc, char** argv) {
+    const int status = runMode(argc, argv);
+    if (mismatches > 0) {
+        std::cerr << mismatches << (mismatches == 1 ? " mismatch\n" : " mismatches\n");
+        return EXIT_FAILURE;
+    }
+    return status;
+}
@@ -1,154 +1,304 @@
 #include "ErrorMeasurement.hpp"
+#include "MetricKernels.hpp"
+#include <algorithm>
 #include <cmath>
+#include <limits>
 #include <vector>
 
-double ErrorMeasurement::variance(const std::vector<std::vector<Color>>& pixels, int x, int y, int width, int height) {
-    int count = width * height;
-    double sumR = 0, sumG = 0, sumB = 0;
+static const uint8_t* rowData(const Image& pixels, int x, int y) {
+    return pixels.pixel(x, y);
+}
 
-    for (int i = y; i < y + height; i++)
-        for (int j = x; j < x + width; j++) {
-            sumR += pixels[i][j].r;
-            sumG += pixels[i][j].g;
-            sumB += pixels[i][j].b;
-        }
+static Color meanColor(const uint64_t sum[3], uint64_t count) {
+    return Color(sum[0] / count, sum[1] / count, sum[2] / count);
+}
+
+static NodeEvaluation withMoments(double error, const BlockMoments& m) {
+    return NodeEvaluation{error, meanColor(m.sum, m.count), true, m};
+}
+
+static NodeEvaluation withSums(double error, const uint64_t sum[3], uint64_t count) {
+    NodeEvaluation eval{error, meanColor(sum, count), false, {}};
+    std::copy(sum, sum + 3, eval.moments.sum);
+    eval.moments.count = count;
+    return eval;
+}
+
+static BlockMoments blockMoments(const MetricSource& source, int x, int y, int width, int height) {
+    if (source.integral)
+        return source.integral->moments(x, y, width, height);
+
+    const MetricKernels& kernels = MetricKernels::active();
+    BlockMoments m = {{0, 0, 0}, {0, 0, 0}, static_cast<uint64_t>(width) * height};
+    for (int i = y; i < y + height; ++i) {
+        kernels.sum(rowData(*source.pixels, x, i), width, m.sum);
+        kernels.sumSquares(rowData(*source.pixels, x, i), width, m.sumSq);
+    }
+    return m;
+}
+
+static double varianceFromMoments(const BlockMoments& m) {
+    double count = static_cast<double>(m.count);
 
-    double avgR = sumR / count;
-    double avgG = sumG / count;
-    double avgB = sumB / count;
+    // count * sumSq - sum^2 is exact in 64 bits for blocks below 2^24 pixels,
+    // which keeps ties against the threshold exact.
+    if (m.count < (1u << 24)) {
+        uint64_t scaled = 0;
+        for (int ch = 0; ch < 3; ++ch)
+            scaled += m.count * m.sumSq[ch] - m.sum[ch] * m.sum[ch];
+        return static_cast<double>(scaled) / (count * count);
+    }
 
     double var = 0.0;
-    for (int i = y; i < y + height; i++)
-        for (int j = x; j < x + width; j++) {
-            var += std::pow(pixels[i][j].r - avgR, 2)
-                 + std::pow(pixels[i][j].g - avgG, 2)
-                 + std::pow(pixels[i][j].b - avgB, 2);
-        }
+    for (int ch = 0; ch < 3; ++ch) {
+        double sum = static_cast<double>(m.sum[ch]);
+        var += static_cast<double>(m.sumSq[ch]) - sum * sum / count;
+    }
+    return std::max(0.0, var / count);
+}
+
+static double ssimFromMoments(const BlockMoments& m) {
+    const double L = 255.0;
+    const double C1 = (0.01 * L) * (0.01 * L);
+    const double C2 = (0.03 * L) * (0.03 * L);
+    if (m.count == 0) return 1.0;
 
-    return var / count;
+    double N = static_cast<double>(m.count);
+    const double weights[3] = {0.2125, 0.7154, 0.0721};
+    double totalWeight = weights[0] + weights[1] + weights[2];
+
+    double totalSSIM = 0.0;
+    for (int channel = 0; channel < 3; ++channel) {
+        double mu = m.sum[channel] / N;
+        double sigma = std::max(0.0, (m.sumSq[channel] - m.sum[channel] * mu) / N);
+
+        // The block is compared against its own flat mean, so sigma_y and covariance are 0
+        double numerator = (2 * mu * mu + C1) * C2;
+        double denominator = (2 * mu * mu + C1) * (sigma + C2);
+        totalSSIM += (numerator / denominator) * weights[channel];
+    }
+
+    return 1.0 - totalSSIM / totalWeight;
 }
 
-double ErrorMeasurement::mad(const std::vector<std::vector<Color>>& pixels, int x, int y, int width, int height) {
-    int count = width * height;
-    double sumR = 0, sumG = 0, sumB = 0;
+// c * log2(c) for every count a 16-bit histogram cell can hold
+static double countLog2Count(uint32_t c) {
+    static const std::vector<double> table = [] {
+        std::vector<double> t(1 << 16, 0.0);
+        for (size_t i = 1; i < t.size(); ++i)
+            t[i] = i * std::log2(static_cast<double>(i));
+        return t;
+    }();
+    return c < table.size() ? table[c] : c * std::log2(static_cast<double>(c));
+}
 
-    for (int i = y; i < y + height; i++)
-        for (int j = x; j < x + width; j++) {
-            sumR += pixels[i][j].r;
-            sumG += pixels[i][j].g;
-            sumB += pixels[i][j].b;
-        }
+// Histogram of a block, from the pyramid when the block is on its grid
+static void blockHistogram(const MetricSource& source, int x, int y, int width, int height,
+                           uint32_t hist[3][ErrorMeasurement::MAX_COLOR]) {
+    if (source.histograms && source.histograms->histogram(x, y, width, height, hist))
+        return;
 
-    double avgR = sumR / count;
-    double avgG = sumG / count;
-    double avgB = sumB / count;
+    const MetricKernels& kernels = MetricKernels::active();
+    std::fill(&hist[0][0], &hist[0][0] + 3 * ErrorMeasurement::MAX_COLOR, 0u);
+    for (int i = y; i < y + height; ++i)
+        kernels.histogram(rowData(*source.pixels, x, i), width, hist);
+}
 
-    double mad = 0.0;
-    for (int i = y; i < y + height; i++)
-        for (int j = x; j < x + width; j++) {
-            mad += std::abs(pixels[i][j].r - avgR)
-                 + std::abs(pixels[i][j].g - avgG)
-                 + std::abs(pixels[i][j].b - avgB);
+static BlockMoments momentsFromHistogram(const uint32_t hist[3][ErrorMeasurement::MAX_COLOR], uint64_t count) {
+    BlockMoments m = {{0, 0, 0}, {0, 0, 0}, count};
+    for (int ch = 0; ch < 3; ++ch)
+        for (uint64_t v = 0; v < ErrorMeasurement::MAX_COLOR; ++v) {
+            m.sum[ch] += v * hist[ch][v];
+            m.sumSq[ch] += v * v * hist[ch][v];
         }
+    return m;
+}
+
+// Entropy of a channel: log2(n) - (1/n) * sum(c * log2(c))
+static double entropyFromHistogram(const uint32_t hist[3][ErrorMeasurement::MAX_COLOR], uint64_t count) {
+    double total = 0.0;
+    for (int ch = 0; ch < 3; ++ch) {
+        double weighted = 0.0;
+        for (int v = 0; v < ErrorMeasurement::MAX_COLOR; ++v)
+            if (hist[ch][v]) weighted += countLog2Count(hist[ch][v]);
+        total += std::log2(static_cast<double>(count)) - weighted / count;
+    }
+    return total / 3.0;
+}
 
-    return mad / count;
-}
-
-double ErrorMeasurement::maxPixelDifference(const std::vector<std::vector<Color>>& pixels, int x, int y, int width, int height) {
-    int minR = 255, minG = 255, minB = 255;
-    int maxR = 0, maxG = 0, maxB = 0;
-    for (int i = y; i < y + height; i++)
-        for (int j = x; j < x + width; j++) {
-            const Color& c = pixels[i][j];
-            if (c.r < minR) minR = c.r;
-            if (c.g < minG) minG = c.g;
-            if (c.b < minB) minB = c.b;
-            if (c.r > maxR) maxR = c.r;
-            if (c.g > maxG) maxG = c.g;
-            if (c.b > maxB) maxB = c.b;
+// n * sum(|v - mean|) = sum(|n * v - sum|), split at the mean so it stays in integers:
+// values with n * v <= sum contribute sum - n * v, the rest n * v - sum. The histogram
+// and the pixel path produce the same integer, and the final division rounds once.
+// The result is at most 128 * n^2, so it is exact in 64 bits for blocks below 2^28
+// pixels (the products may wrap, their difference does not); larger blocks work in
+// 128 bits, as do the sums over channels.
+using WideCount = unsigned __int128;
+
+static WideCount scaledDeviation(uint64_t sum, uint64_t countBelow, uint64_t sumBelow, uint64_t count) {
+    if (count < (1u << 28))
+        return (countBelow * sum - count * sumBelow) + (count * (sum - sumBelow) - (count - countBelow) * sum);
+    const WideCount n = count;
+    return (countBelow * WideCount(sum) - n * sumBelow) + (n * (sum - sumBelow) - (count - countBelow) * WideCount(sum));
+}
+
+static double madFromHistogram(const uint32_t hist[3][ErrorMeasurement::MAX_COLOR], const BlockMoments& m) {
+    WideCount scaled = 0;
+    for (int ch = 0; ch < 3; ++ch) {
+        uint64_t countBelow = 0, sumBelow = 0;
+        for (uint64_t v = 0; v < ErrorMeasurement::MAX_COLOR && m.count * v <= m.sum[ch]; ++v) {
+            countBelow += hist[ch][v];
+            sumBelow += v * hist[ch][v];
         }
-    double diffR = maxR - minR;
-    double diffG = maxG - minG;
-    double diffB = maxB - minB;
-    return (diffR + diffG + diffB) / 3.0;
+        scaled += scaledDeviation(m.sum[ch], countBelow, sumBelow, m.count);
+    }
+    return static_cast<double>(scaled) / (static_cast<double>(m.count) * m.count);
 }
 
-double ErrorMeasurement::entropy(const std::vector<std::vector<Color>>& pixels, int x, int y, int width, int height) {
+// Small blocks: a couple of passes over the pixels is cheaper than touching 3 * 256 bins
+static NodeEvaluation madFromPixels(const Image& pixels, int x, int y, int width, int height) {
+    const MetricKernels& kernels = MetricKernels::active();
+    const uint64_t count = static_cast<uint64_t>(width) * height;
+    uint64_t sum[3] = {0, 0, 0};
+    for (int i = y; i < y + height; ++i)
+        kernels.sum(rowData(pixels, x, i), width, sum);
+
+    // count * v <= sum  <=>  v <= floor(sum / count) for integer v
+    const int limit[3] = {static_cast<int>(sum[0] / count), static_cast<int>(sum[1] / count),
+                          static_cast<int>(sum[2] / count)};
+    uint64_t countBelow[3] = {0, 0, 0}, sumBelow[3] = {0, 0, 0};
+    for (int i = y; i < y + height; ++i)
+        kernels.splitBelow(rowData(pixels, x, i), width, limit, countBelow, sumBelow);
+
+    WideCount scaled = 0;
+    for (int ch = 0; ch < 3; ++ch)
+        scaled += scaledDeviation(sum[ch], countBelow[ch], sumBelow[ch], count);
+    return withSums(static_cast<double>(scaled) / (static_cast<double>(count) * count), sum, count);
+}
+
+// Small blocks: count into a scratch histogram that is kept zeroed, then visit each
+// distinct value once through the pixels instead of scanning all bins.
+static NodeEvaluation entropyFromPixels(const Image& pixels, int x, int y, int width, int height) {
+    thread_local uint32_t hist[3][ErrorMeasurement::MAX_COLOR] = {};
+    const MetricKernels& kernels = MetricKernels::active();
     const int count = width * height;
-    std::vector<int> histR(MAX_COLOR, 0), histG(MAX_COLOR, 0), histB(MAX_COLOR, 0);
-    
+
     for (int i = y; i < y + height; ++i)
-        for (int j = x; j < x + width; ++j) {
-            const Color& c = pixels[i][j];
-            ++histR[c.r];
-            ++histG[c.g];
-            ++histB[c.b];
-        }
-    
-    auto computeEntropyChannel = [count](const std::vector<int>& hist) -> double {
-        double ent = 0.0;
-        for (int i = 0; i < MAX_COLOR; ++i) {
-            if (hist[i] > 0) {
-                double p = static_cast<double>(hist[i]) / count;
-                ent -= p * std::log2(p);
-            }
+        kernels.histogram(rowData(pixels, x, i), width, hist);
+
+    double weighted[3] = {0.0, 0.0, 0.0};
+    BlockMoments m = {{0, 0, 0}, {0, 0, 0}, static_cast<uint64_t>(count)};
+    for (int i = y; i < y + height; ++i) {
+        const uint8_t* row = rowData(pixels, x, i);
+        for (int j = 0; j < 3 * width; j += 3) {
+            const uint64_t v[3] = {row[j], row[j + 1], row[j + 2]};
+            for (int ch = 0; ch < 3; ++ch)
+                if (uint64_t c = hist[ch][v[ch]]) {
+                    weighted[ch] += countLog2Count(c);
+                    m.sum[ch] += c * v[ch];
+                    m.sumSq[ch] += c * v[ch] * v[ch];
+                    hist[ch][v[ch]] = 0;
+                }
         }
-        return ent;
-    };
-    
-    return (computeEntropyChannel(histR) + computeEntropyChannel(histG) + computeEntropyChannel(histB)) / 3.0;
-}
+    }
 
-double ErrorMeasurement::ssim(const std::vector<std::vector<Color>>& pixels, int x, int y, int width, int height) {
-    const double L = 255.0;
-    const double C1 = (0.01 * L) * (0.01 * L);
-    const double C2 = (0.03 * L) * (0.03 * L);
-    int N = width * height;
+    double total = 0.0;
+    for (int ch = 0; ch < 3; ++ch)
+        total += std::log2(static_cast<double>(count)) - weighted[ch] / count;
+    return withMoments(total / 3.0, m);
+}
 
-    if (N == 0) return 1.0;
+NodeEvaluation ErrorMeasurement::variance(const MetricSource& source, int x, int y, int width, int height) {
+    BlockMoments m = blockMoments(source, x, y, width, height);
+    return withMoments(varianceFromMoments(m), m);
+}
 
-    std::vector<double> weights = {0.2125, 0.7154, 0.0721}; 
-    double totalWeight = weights[0] + weights[1] + weights[2];
+NodeEvaluation ErrorMeasurement::mad(const MetricSource& source, int x, int y, int width, int height) {
+    if (static_cast<int64_t>(width) * height < SMALL_BLOCK_AREA)
+        return madFromPixels(*source.pixels, x, y, width, height);
 
-    double totalSSIM = 0.0;
+    uint32_t hist[3][MAX_COLOR];
+    blockHistogram(source, x, y, width, height, hist);
+    BlockMoments m = momentsFromHistogram(hist, static_cast<uint64_t>(width) * height);
+    return withMoments(madFromHistogram(hist, m), m);
+}
 
-    for (int channel = 0; channel < 3; ++channel) {
-        double mu = 0.0;
-        double sigma = 0.0;
+NodeEvaluation ErrorMeasurement::maxPixelDifference(const MetricSource& source, int x, int y, int width, int height) {
+    int minValue[3] = {255, 255, 255};
+    int maxValue[3] = {0, 0, 0};
+    bool fromPyramid = source.ranges && source.ranges->range(x, y, width, height, minValue, maxValue);
 
+    // The mean comes from the integral tables when there are any, otherwise it is
+    // summed in the same scan as the min/max
+    uint64_t sum[3] = {0, 0, 0};
+    if (!fromPyramid || !source.integral) {
+        const MetricKernels& kernels = MetricKernels::active();
         for (int i = y; i < y + height; ++i) {
-            for (int j = x; j < x + width; ++j) {
-                double val = 0.0;
-                if (channel == 0) val = pixels[i][j].r;
-                else if (channel == 1) val = pixels[i][j].g;
-                else if (channel == 2) val = pixels[i][j].b;
-                mu += val;
-            }
+            const uint8_t* row = rowData(*source.pixels, x, i);
+            if (!fromPyramid) kernels.minMax(row, width, minValue, maxValue);
+            if (!source.integral) kernels.sum(row, width, sum);
         }
-        mu /= N;
+    }
 
-        for (int i = y; i < y + height; ++i) {
-            for (int j = x; j < x + width; ++j) {
-                double val = 0.0;
-                if (channel == 0) val = pixels[i][j].r;
-                else if (channel == 1) val = pixels[i][j].g;
-                else if (channel == 2) val = pixels[i][j].b;
-                sigma += (val - mu) * (val - mu);
-            }
-        }
-        sigma /= N;
+    double diffR = maxValue[0] - minValue[0];
+    double diffG = maxValue[1] - minValue[1];
+    double diffB = maxValue[2] - minValue[2];
+    double error = (diffR + diffG + diffB) / 3.0;
+
+    if (source.integral)
+        return withMoments(error, source.integral->moments(x, y, width, height));
+    return withSums(error, sum, static_cast<uint64_t>(width) * height);
+}
+
+NodeEvaluation ErrorMeasurement::entropy(const MetricSource& source, int x, int y, int width, int height) {
+    if (static_cast<int64_t>(width) * height < SMALL_BLOCK_AREA)
+        return entropyFromPixels(*source.pixels, x, y, width, height);
 
-        double mu_y = mu;
-        double sigma_y = 0.0;
-        double covariance = 0.0;
+    uint32_t hist[3][MAX_COLOR];
+    blockHistogram(source, x, y, width, height, hist);
+    return withMoments(entropyFromHistogram(hist, static_cast<uint64_t>(width) * height),
+                       momentsFromHistogram(hist, static_cast<uint64_t>(width) * height));
+}
 
-        double numerator = (2 * mu * mu_y + C1) * (2 * covariance + C2);
-        double denominator = (mu * mu + mu_y * mu_y + C1) * (sigma + sigma_y + C2);
-        double ssim = (denominator == 0.0) ? 1.0 : numerator / denominator;
+NodeEvaluation ErrorMeasurement::ssim(const MetricSource& source, int x, int y, int width, int height) {
+    BlockMoments m = blockMoments(source, x, y, width, height);
+    return withMoments(ssimFromMoments(m), m);
+}
 
-        totalSSIM += ssim * weights[channel];
+BlockMoments ErrorMeasurement::moments(const MetricSource& source, int x, int y, int width, int height) {
+    return blockMoments(source, x, y, width, height);
+}
+
+uint64_t ErrorMeasurement::squaredError(const BlockMoments& m, const Color& c) {
+    // sum((v - c)^2) = sumSq - 2 * c * sum + n * c^2
+    const uint64_t colour[3] = {static_cast<uint64_t>(c.r), static_cast<uint64_t>(c.g), static_cast<uint64_t>(c.b)};
+    uint64_t error = 0;
+    for (int ch = 0; ch < 3; ++ch)
+        error += m.sumSq[ch] - 2 * colour[ch] * m.sum[ch] + m.count * colour[ch] * colour[ch];
+    return error;
+}
+
+double ErrorMeasurement::flatSsim(const BlockMoments& m, const Color& c) {
+    const double L = 255.0;
+    const double C1 = (0.01 * L) * (0.01 * L);
+    const double C2 = (0.03 * L) * (0.03 * L);
+    if (m.count == 0) return 1.0;
+
+    double N = static_cast<double>(m.count);
+    const double colour[3] = {static_cast<double>(c.r), static_cast<double>(c.g), static_cast<double>(c.b)};
+    const double weights[3] = {0.2125, 0.7154, 0.0721};
+
+    // As ssimFromMoments, but against the colour the leaf is drawn in rather than the exact mean
+    double total = 0.0;
+    for (int channel = 0; channel < 3; ++channel) {
+        double mu = m.sum[channel] / N;
+        double sigma = std::max(0.0, (m.sumSq[channel] - m.sum[channel] * mu) / N);
+        double luminance = (2 * mu * colour[channel] + C1) / (mu * mu + colour[channel] * colour[channel] + C1);
+        total += luminance * C2 / (sigma + C2) * weights[channel];
     }
+    return total / (weights[0] + weights[1] + weights[2]);
+}
 
-    double ssim_avg = totalSSIM / totalWeight;
-    return 1.0 - ssim_avg;
-}
\ No newline at end of file
+double ErrorMeasurement::psnr(double squaredError, double samples) {
+    if (squaredError <= 0) return std::numeric_limits<double>::infinity();
+    return 10.0 * std::log10(255.0 * 255.0 * samples / squaredError);
+}
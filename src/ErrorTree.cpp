@@ -0,0 +1,131 @@
+#include "ErrorTree.hpp"
+#include "ErrorMeasurement.hpp"
+#include "MetricKernels.hpp"
+#include <algorithm>
+#include <limits>
+#include <utility>
+
+ErrorTree::ErrorTree(Quadtree* full, const Image& pixels)
+    : full(full), squaredError(full->getNodes().size()), similarity(full->getNodes().size()),
+      samples(3 * static_cast<uint64_t>(full->getWidth()) * full->getHeight()) {
+    if (!squaredError.empty()) collect(0, pixels);
+}
+
+// Moments of a block: scanned at the leaves of the full tree (which tile the
+// image, so one pass over the pixels in total) and summed up the tree
+BlockMoments ErrorTree::collect(uint32_t index, const Image& pixels) {
+    const QuadtreeNode& node = full->getNodes()[index];
+    BlockMoments m = {{0, 0, 0}, {0, 0, 0}, static_cast<uint64_t>(node.width) * node.height};
+
+    if (node.is_leaf) {
+        const MetricKernels& kernels = MetricKernels::active();
+        for (int y = node.y; y < node.y + node.height; ++y) {
+            kernels.sum(pixels.pixel(node.x, y), node.width, m.sum);
+            kernels.sumSquares(pixels.pixel(node.x, y), node.width, m.sumSq);
+        }
+    } else {
+        for (uint32_t child : node.children) {
+            BlockMoments c = collect(child, pixels);
+            for (int ch = 0; ch < 3; ++ch) {
+                m.sum[ch] += c.sum[ch];
+                m.sumSq[ch] += c.sumSq[ch];
+            }
+        }
+    }
+
+    squaredError[index] = ErrorMeasurement::squaredError(m, node.color);
+    similarity[index] = m.count * ErrorMeasurement::flatSsim(m, node.color);
+    return m;
+}
+
+Quadtree* ErrorTree::cut(double threshold) const {
+    // Reserving the full size costs address space only, the untouched tail is never paged in
+    std::vector<QuadtreeNode> nodes;
+    nodes.reserve(squaredError.size());
+    if (!squaredError.empty()) cut(0, nullptr, threshold, nodes);
+    return new Quadtree(std::move(nodes), full->getWidth(), full->getHeight());
+}
+
+Quadtree* ErrorTree::cut(const std::vector<double>& keys, double limit) const {
+    std::vector<QuadtreeNode> nodes;
+    nodes.reserve(squaredError.size());
+    if (!squaredError.empty()) cut(0, keys.data(), limit, nodes);
+    return new Quadtree(std::move(nodes), full->getWidth(), full->getHeight());
+}
+
+uint32_t ErrorTree::cut(uint32_t index, const double* keys, double limit, std::vector<QuadtreeNode>& out) const {
+    const QuadtreeNode& source = full->getNodes()[index];
+    const uint32_t at = out.size();
+    out.push_back(source);
+
+    if (source.is_leaf || (keys ? keys[index] : source.error) <= limit) {
+        out[at].is_leaf = true;
+        std::fill(out[at].children, out[at].children + 4, QuadtreeNode::NONE);
+        return at;
+    }
+    for (int i = 0; i < 4; ++i) {
+        uint32_t child = cut(source.children[i], keys, limit, out);
+        out[at].children[i] = child;
+    }
+    return at;
+}
+
+std::vector<SweepPoint> ErrorTree::sweep(const std::vector<double>& thresholds) const {
+    std::vector<double> sorted(thresholds);
+    std::sort(sorted.begin(), sorted.end());
+    auto firstAtLeast = [&](double value) {
+        return static_cast<size_t>(std::lower_bound(sorted.begin(), sorted.end(), value) - sorted.begin());
+    };
+
+    // A node is visible for thresholds below the smallest error of its ancestors,
+    // and a leaf from its own error on (always, at the bottom of the full tree).
+    // Each node adds to a range of sorted thresholds through difference arrays.
+    const size_t k = sorted.size();
+    std::vector<int64_t> nodeDiff(k + 1, 0), leafDiff(k + 1, 0), errorDiff(k + 1, 0);
+    std::vector<double> similarityDiff(k + 1, 0.0);
+    std::vector<std::pair<uint32_t, double>> stack;
+    if (!squaredError.empty()) stack.push_back({0, std::numeric_limits<double>::infinity()});
+
+    while (!stack.empty()) {
+        auto [index, bound] = stack.back();
+        stack.pop_back();
+
+        const size_t end = firstAtLeast(bound);
+        if (end == 0) continue; // hidden at every threshold, and so is its subtree
+        ++nodeDiff[0];
+        --nodeDiff[end];
+
+        const QuadtreeNode& node = full->getNodes()[index];
+        const size_t begin = node.is_leaf ? 0 : firstAtLeast(node.error);
+        if (begin < end) {
+            ++leafDiff[begin];
+            --leafDiff[end];
+            errorDiff[begin] += squaredError[index];
+            errorDiff[end] -= squaredError[index];
+            similarityDiff[begin] += similarity[index];
+            similarityDiff[end] -= similarity[index];
+        }
+        if (!node.is_leaf)
+            for (uint32_t child : node.children)
+                stack.push_back({child, std::min(bound, node.error)});
+    }
+
+    std::vector<SweepPoint> bySorted(k);
+    int64_t nodes = 0, leaves = 0, error = 0;
+    double similar = 0.0;
+    for (size_t i = 0; i < k; ++i) {
+        nodes += nodeDiff[i];
+        leaves += leafDiff[i];
+        error += errorDiff[i];
+        similar += similarityDiff[i];
+        bySorted[i] = SweepPoint{sorted[i], static_cast<size_t>(nodes), static_cast<size_t>(leaves),
+                                 (nodes + 24.0 * leaves) / 8.0, ErrorMeasurement::psnr(error, samples),
+                                 similar / (samples / 3)};
+    }
+
+    // Back in the order asked for
+    std::vector<SweepPoint> points;
+    for (double t : thresholds)
+        points.push_back(bySorted[firstAtLeast(t)]);
+    return points;
+}
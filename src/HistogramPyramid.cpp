@@ -0,0 +1,101 @@
+#include "HistogramPyramid.hpp"
+#include <algorithm>
+
+template <typename Fn>
+static void withBins(std::vector<uint16_t>& narrow, std::vector<uint32_t>& wide, bool isNarrow, Fn fn) {
+    if (isNarrow) fn(narrow.data());
+    else fn(wide.data());
+}
+
+template <typename Parent, typename Child>
+static void mergeChildren(Parent* parent, const Child* child, int parentCells) {
+    const int bins = 3 * HistogramPyramid::BINS;
+    const int childCols = parentCells * 2;
+    for (int r = 0; r < parentCells; ++r)
+        for (int c = 0; c < parentCells; ++c) {
+            Parent* dst = parent + (static_cast<size_t>(r) * parentCells + c) * bins;
+            const Child* c00 = child + (static_cast<size_t>(2 * r) * childCols + 2 * c) * bins;
+            const Child* c01 = c00 + bins;
+            const Child* c10 = c00 + static_cast<size_t>(childCols) * bins;
+            const Child* c11 = c10 + bins;
+            for (int i = 0; i < bins; ++i)
+                dst[i] = static_cast<Parent>(c00[i] + c01[i] + c10[i] + c11[i]);
+        }
+}
+
+HistogramPyramid::HistogramPyramid() {}
+
+void HistogramPyramid::build(const Image& pixels) {
+    const int height = pixels.getHeight();
+    const int width = pixels.getWidth();
+    levels.clear();
+    grid.build(width, height, MIN_CELL_AREA, 16);
+    if (grid.levels() == 0) return;
+
+    // Keep as many levels as fit in the memory budget
+    size_t totalBytes = 0;
+    for (int d = 0; d < grid.levels(); ++d) {
+        Level level;
+        level.narrow = grid.maxCellArea(d) <= 0xFFFF;
+
+        size_t count = (static_cast<size_t>(1) << (2 * d)) * 3 * BINS;
+        totalBytes += count * (level.narrow ? sizeof(uint16_t) : sizeof(uint32_t));
+        if (d > 0 && totalBytes > MAX_BYTES) break;
+
+        if (level.narrow) level.narrowBins.assign(count, 0);
+        else level.wideBins.assign(count, 0);
+        levels.push_back(std::move(level));
+    }
+    grid.truncate(levels.size());
+
+    // Finest level straight from the pixels
+    Level& finest = levels.back();
+    const size_t cells = static_cast<size_t>(1) << (levels.size() - 1);
+    const std::vector<int> colOf = grid.finestColumnOf();
+    const std::vector<int> rowOf = grid.finestRowOf();
+
+    withBins(finest.narrowBins, finest.wideBins, finest.narrow, [&](auto* bins) {
+        for (int y = 0; y < height; ++y) {
+            const size_t rowBase = rowOf[y] * cells;
+            const uint8_t* src = pixels.row(y);
+            for (int x = 0; x < width; ++x) {
+                auto* hist = bins + (rowBase + colOf[x]) * 3 * BINS;
+                const uint8_t* c = src + 3 * x;
+                ++hist[c[0]];
+                ++hist[BINS + c[1]];
+                ++hist[2 * BINS + c[2]];
+            }
+        }
+    });
+
+    // Every coarser level is the sum of its four children
+    for (int d = static_cast<int>(levels.size()) - 2; d >= 0; --d) {
+        Level& parent = levels[d];
+        Level& child = levels[d + 1];
+        withBins(parent.narrowBins, parent.wideBins, parent.narrow, [&](auto* dst) {
+            withBins(child.narrowBins, child.wideBins, child.narrow, [&](auto* src) {
+                mergeChildren(dst, src, 1 << d);
+            });
+        });
+    }
+}
+
+bool HistogramPyramid::matches(int width, int height) const {
+    return !levels.empty() && grid.width() == width && grid.height() == height;
+}
+
+bool HistogramPyramid::histogram(int x, int y, int width, int height, uint32_t hist[3][BINS]) const {
+    int d;
+    size_t cell;
+    if (!grid.locate(x, y, width, height, d, cell)) return false;
+
+    const Level& level = levels[d];
+    const size_t offset = cell * 3 * BINS;
+    auto copy = [&](const auto* bins) {
+        for (int ch = 0; ch < 3; ++ch)
+            std::copy(bins + offset + ch * BINS, bins + offset + (ch + 1) * BINS, hist[ch]);
+    };
+    if (level.narrow) copy(level.narrowBins.data());
+    else copy(level.wideBins.data());
+    return true;
+}
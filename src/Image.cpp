@@ -0,0 +1,37 @@
+#include "Image.hpp"
+#include <cstring>
+#include <utility>
+
+Image::Image() : width(0), height(0), stride(0), pixels(nullptr, releaseOwned) {}
+
+Image::Image(int width, int height, const Color& fill)
+    : width(width), height(height), stride(3 * static_cast<size_t>(width)),
+      pixels(new uint8_t[stride * height], releaseOwned) {
+    this->fill(0, 0, width, height, fill);
+}
+
+Image::Image(uint8_t* data, int width, int height, size_t stride, Release release)
+    : width(width), height(height), stride(stride), pixels(data, std::move(release)) {}
+
+Image::Image(const Image& other)
+    : width(other.width), height(other.height), stride(3 * static_cast<size_t>(other.width)),
+      pixels(new uint8_t[stride * other.height], releaseOwned) {
+    for (int y = 0; y < height; ++y)
+        std::memcpy(row(y), other.row(y), stride);
+}
+
+Image& Image::operator=(const Image& other) {
+    if (this != &other) *this = Image(other);
+    return *this;
+}
+
+void Image::fill(int x, int y, int width, int height, const Color& c) {
+    for (int i = y; i < y + height; ++i) {
+        uint8_t* p = row(i) + 3 * static_cast<size_t>(x);
+        for (int j = 0; j < width; ++j, p += 3) {
+            p[0] = c.r;
+            p[1] = c.g;
+            p[2] = c.b;
+        }
+    }
+}
@@ -5,13 +5,239 @@
 #include "stb_image_write.h"
 
 #include "ImageIO.hpp"
+#include "QoiCodec.hpp"
+#include <algorithm>
 #include <iostream>
 #include <fstream>
 #include <filesystem>
+#include <cstring>
+#include <cctype>
+#include <climits>
+#include <cstdlib>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
 
 using namespace std;
 
-bool ImageIO::loadImage(const std::string &path, std::vector<std::vector<Color>> &pixelData) {
+// The whole file mapped copy-on-write: pages are read in as they are first touched,
+// and anything written through the image stays private instead of reaching the file
+static uint8_t *mapFile(const std::string &path, size_t &size) {
+#ifdef _WIN32
+    HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+                              FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE) return nullptr;
+    LARGE_INTEGER length;
+    HANDLE mapping = nullptr;
+    void *view = nullptr;
+    if (GetFileSizeEx(file, &length) && length.QuadPart > 0 &&
+        (mapping = CreateFileMappingA(file, nullptr, PAGE_WRITECOPY, 0, 0, nullptr)))
+        view = MapViewOfFile(mapping, FILE_MAP_COPY, 0, 0, 0);
+    // The view holds the mapping open by itself
+    if (mapping) CloseHandle(mapping);
+    CloseHandle(file);
+    size = view ? static_cast<size_t>(length.QuadPart) : 0;
+    return static_cast<uint8_t *>(view);
+#else
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) return nullptr;
+    struct stat info;
+    void *view = MAP_FAILED;
+    if (fstat(fd, &info) == 0 && info.st_size > 0)
+        view = mmap(nullptr, info.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (view == MAP_FAILED) return nullptr;
+    size = info.st_size;
+    return static_cast<uint8_t *>(view);
+#endif
+}
+
+static void unmapFile(uint8_t *data, size_t size) {
+#ifdef _WIN32
+    (void)size;
+    UnmapViewOfFile(data);
+#else
+    munmap(data, size);
+#endif
+}
+
+static bool hasExtension(const std::string &path, const char *extension) {
+    const size_t length = strlen(extension);
+    if (path.size() < length) return false;
+    for (size_t i = 0; i < length; ++i)
+        if (tolower(static_cast<unsigned char>(path[path.size() - length + i])) != extension[i]) return false;
+    return true;
+}
+
+// Next word of a PNM header from pos, past whitespace and # comments. The one
+// whitespace byte that ends it is consumed too, so after the last field pos is
+// where the pixels start.
+static std::string headerWord(const uint8_t *data, size_t size, size_t &pos) {
+    while (pos < size && (data[pos] == '#' || isspace(data[pos]))) {
+        if (data[pos] == '#')
+            while (pos < size && data[pos] != '\n') ++pos;
+        ++pos;
+    }
+    std::string word;
+    while (pos < size && !isspace(data[pos]) && word.size() < 32)
+        word += static_cast<char>(data[pos++]);
+    if (pos < size) ++pos;
+    return word;
+}
+
+static bool headerNumber(const std::string &word, int64_t &value) {
+    char *end = nullptr;
+    value = std::strtoll(word.c_str(), &end, 10);
+    return !word.empty() && *end == '\0' && value > 0 && value <= INT_MAX;
+}
+
+// Binary PPM (P6) or PAM (P7), 8 bits per sample
+static bool parsePnm(const uint8_t *data, size_t size, RawLayout &layout) {
+    if (size < 3 || data[0] != 'P' || (data[1] != '6' && data[1] != '7')) return false;
+    layout = RawLayout();
+    size_t pos = 2;
+    int64_t maxValue = 0;
+    if (data[1] == '6') {
+        if (!headerNumber(headerWord(data, size, pos), layout.width) ||
+            !headerNumber(headerWord(data, size, pos), layout.height) ||
+            !headerNumber(headerWord(data, size, pos), maxValue))
+            return false;
+        layout.depth = 3;
+    } else {
+        layout.depth = 0;
+        for (std::string key = headerWord(data, size, pos); key != "ENDHDR"; key = headerWord(data, size, pos)) {
+            if (key.empty()) return false;
+            std::string value = headerWord(data, size, pos);
+            if (key == "WIDTH" && !headerNumber(value, layout.width)) return false;
+            if (key == "HEIGHT" && !headerNumber(value, layout.height)) return false;
+            if (key == "DEPTH" && !headerNumber(value, layout.depth)) return false;
+            if (key == "MAXVAL" && !headerNumber(value, maxValue)) return false;
+        }
+    }
+    layout.stride = layout.width * layout.depth;
+    layout.offset = pos;
+    // A header running to the end of data was cut short, or has no pixels after it
+    return pos < size && maxValue == 255 && layout.depth >= 1 && layout.depth <= 4;
+}
+
+// Raw RGB described by a text sidecar next to it (frame.rgb.hdr for frame.rgb):
+// "width W" and "height H" lines, optionally "stride BYTES" and "offset BYTES"
+static bool readSidecar(const std::string &path, RawLayout &layout) {
+    ifstream header(path + ".hdr");
+    if (!header) return false;
+    std::string key;
+    int64_t value;
+    while (header >> key >> value) {
+        if (key == "width") layout.width = value;
+        else if (key == "height") layout.height = value;
+        else if (key == "stride") layout.stride = value;
+        else if (key == "offset") layout.offset = value;
+        else return false;
+    }
+    // The sizes are checked before any arithmetic with them
+    if (layout.width <= 0 || layout.width > INT_MAX || layout.height <= 0 || layout.height > INT_MAX ||
+        layout.offset < 0 || layout.stride < 0)
+        return false;
+    if (layout.stride == 0) layout.stride = 3 * layout.width;
+    return layout.stride >= 3 * layout.width;
+}
+
+// Whether every row lies inside the file. Width, height and depth are already
+// bounded, but the stride and offset come from the file and may be anything, so
+// the rows are counted by division rather than their end multiplied out.
+static bool fitsIn(const RawLayout &layout, size_t size) {
+    const int64_t row = layout.depth * layout.width;
+    if (layout.offset > static_cast<int64_t>(size) || row > layout.stride) return false;
+    const int64_t rest = static_cast<int64_t>(size) - layout.offset;
+    return row <= rest && layout.height - 1 <= (rest - row) / layout.stride;
+}
+
+// The layout from the sidecar if there is one, else from the PNM header among the
+// first headSize bytes of the file, and in either case inside its fileSize bytes
+static bool findLayout(const std::string &path, const uint8_t *head, size_t headSize, size_t fileSize,
+                       RawLayout &layout) {
+    return (readSidecar(path, layout) || parsePnm(head, headSize, layout)) && fitsIn(layout, fileSize);
+}
+
+void RawLayout::toRgb(const uint8_t *row, uint8_t *rgb) const {
+    if (depth == 3) {
+        memcpy(rgb, row, 3 * static_cast<size_t>(width));
+        return;
+    }
+    for (int64_t x = 0; x < width; ++x, row += depth, rgb += 3) {
+        rgb[0] = row[0];
+        rgb[1] = row[depth < 3 ? 0 : 1];
+        rgb[2] = row[depth < 3 ? 0 : 2];
+    }
+}
+
+bool ImageIO::rawLayout(const std::string &path, RawLayout &layout) {
+    ifstream file(path, ios::binary | ios::ate);
+    if (!file) return false;
+    const int64_t size = file.tellg();
+    // Enough for any header but one padded out with very long comments
+    std::vector<uint8_t> head(static_cast<size_t>(std::min<int64_t>(size, 1 << 16)));
+    file.seekg(0);
+    if (!file.read(reinterpret_cast<char *>(head.data()), head.size())) return false;
+    return findLayout(path, head.data(), head.size(), size, layout);
+}
+
+bool ImageIO::mapImage(const std::string &path, Image &pixelData, RunStats *stats) {
+    RunStats::Scope timer(stats, RunStats::DECODE);
+    RawLayout layout;
+    size_t size = 0;
+    uint8_t *base = mapFile(path, size);
+    if (!base) return false;
+    if (!findLayout(path, base, size, size, layout)) {
+        unmapFile(base, size);
+        return false;
+    }
+
+    const int width = static_cast<int>(layout.width);
+    const int height = static_cast<int>(layout.height);
+    if (layout.depth == 3) {
+        // Already rows of r, g, b: the image is a view of the mapping and owns it
+        pixelData = Image(base + layout.offset, width, height, layout.stride,
+                          [base, size](uint8_t *) { unmapFile(base, size); });
+        return true;
+    }
+
+    // Grey, grey + alpha and RGBA are expanded or packed into an image of their own
+    Image image(width, height);
+    for (int y = 0; y < height; ++y)
+        layout.toRgb(base + layout.offset + y * layout.stride, image.row(y));
+    unmapFile(base, size);
+    pixelData = std::move(image);
+    return true;
+}
+
+// QOI decodes straight from the mapped file into the image
+static bool loadQoi(const std::string &path, Image &pixelData) {
+    size_t size = 0;
+    uint8_t *data = mapFile(path, size);
+    if (!data) return false;
+    bool decoded = QoiCodec::decode(data, size, pixelData);
+    unmapFile(data, size);
+    return decoded;
+}
+
+bool ImageIO::loadImage(const std::string &path, Image &pixelData, RunStats *stats) {
+    if (mapImage(path, pixelData, stats)) return true;
+
+    RunStats::Scope timer(stats, RunStats::DECODE);
+    if (hasExtension(path, ".qoi")) {
+        if (loadQoi(path, pixelData)) return true;
+        cerr << "Failed to load image: " << path << endl;
+        return false;
+    }
     int width, height, channels;
     unsigned char *data = stbi_load(path.c_str(), &width, &height, &channels, 3); // Paksa jadi RGB (tanpa alpha)
     if (!data) {
@@ -19,70 +245,188 @@ bool ImageIO::loadImage(const std::string &path, std::vector<std::vector<Color>>
         return false;
     }
 
-    pixelData.resize(height, std::vector<Color>(width));
-    for (int y = 0; y < height; ++y)
-        for (int x = 0; x < width; ++x) {
-            int idx = (y * width + x) * 3;
-            pixelData[y][x] = Color(data[idx], data[idx + 1], data[idx + 2]);
+    // stb's output is already packed RGB rows, so the image takes the buffer as it is
+    pixelData = Image(data, width, height, static_cast<size_t>(width) * 3, [](uint8_t *pixels) { stbi_image_free(pixels); });
+    return true;
+}
+
+static std::string ppmHeader(int width, int height) {
+    return "P6\n" + to_string(width) + " " + to_string(height) + "\n255\n";
+}
+
+// The tree rendered as it is written out, with the leaf outlines when asked for
+static Image renderTree(const Quadtree& tree, bool drawOutline) {
+    Image image = tree.renderToPixels();
+    if (drawOutline) {
+        // Each outline stays inside its own leaf, so leaves can be drawn in any order
+        Color black(0, 0, 0);
+        for (const QuadtreeNode& node : tree.getNodes()) {
+            if (!node.is_leaf) continue;
+            image.fill(node.x, node.y, node.width, 1, black);
+            image.fill(node.x, node.y + node.height - 1, node.width, 1, black);
+            image.fill(node.x, node.y, 1, node.height, black);
+            image.fill(node.x + node.width - 1, node.y, 1, node.height, black);
         }
+    }
+    return image;
+}
+
+// Rows [top, top + band height) of what renderTree draws, descending only into the
+// nodes that reach into them
+static void renderBand(const Quadtree &tree, const QuadtreeNode &node, bool drawOutline, int top, Image &band) {
+    const int first = std::max(node.y, top);
+    const int end = std::min(node.y + node.height, top + band.getHeight());
+    if (first >= end) return;
+    if (!node.is_leaf) {
+        for (int i = 0; i < 4; ++i)
+            renderBand(tree, tree.child(node, i), drawOutline, top, band);
+        return;
+    }
+    band.fill(node.x, first - top, node.width, end - first, node.color);
+    if (drawOutline) {
+        Color black(0, 0, 0);
+        if (node.y == first) band.fill(node.x, first - top, node.width, 1, black);
+        if (node.y + node.height == end) band.fill(node.x, end - 1 - top, node.width, 1, black);
+        band.fill(node.x, first - top, 1, end - first, black);
+        band.fill(node.x + node.width - 1, first - top, 1, end - first, black);
+    }
+}
 
-    stbi_image_free(data);
+// Bytes of output rendered at a time where it can be written in bands
+static const int64_t OUTPUT_BAND_BYTES = 1 << 20;
+
+// PPM needs no encoder that takes the image in one piece, so it is rendered and
+// written a band of rows at a time and the output is never held whole
+static bool savePpm(const std::string &path, const Quadtree &tree, bool drawOutline, RunStats *stats) {
+    const int width = tree.getWidth();
+    const int height = tree.getHeight();
+    const int bandRows = static_cast<int>(std::max<int64_t>(1, OUTPUT_BAND_BYTES / (3 * int64_t(width))));
+    ofstream out(path, ios::binary);
+    const std::string header = ppmHeader(width, height);
+    out.write(header.data(), header.size());
+    Image band;
+    for (int top = 0; top < height && out; top += bandRows) {
+        const int rows = std::min(bandRows, height - top);
+        {
+            RunStats::Scope timer(stats, RunStats::RENDER);
+            if (band.getHeight() != rows) band = Image(width, rows);
+            renderBand(tree, tree.getRoot(), drawOutline, top, band);
+        }
+        RunStats::Scope timer(stats, RunStats::ENCODE);
+        for (int y = 0; y < rows; ++y)
+            out.write(reinterpret_cast<const char *>(band.row(y)), 3 * static_cast<std::streamsize>(width));
+    }
+    out.close();
+    return static_cast<bool>(out);
+}
+
+bool ImageIO::codecFor(const std::string &path, ImageCodec &codec) {
+    if (hasExtension(path, ".png")) codec = ImageCodec::PNG;
+    else if (hasExtension(path, ".jpg") || hasExtension(path, ".jpeg")) codec = ImageCodec::JPEG;
+    else if (hasExtension(path, ".bmp")) codec = ImageCodec::BMP;
+    else if (hasExtension(path, ".tga")) codec = ImageCodec::TGA;
+    else if (hasExtension(path, ".ppm")) codec = ImageCodec::PPM;
+    else if (hasExtension(path, ".qoi")) codec = ImageCodec::QOI;
+    else return false;
     return true;
 }
 
-bool ImageIO::saveImage(const std::string &path, Quadtree *tree, bool drawOutline) {
-    if (!tree || !tree->getRoot()) {
+// Streams the image in codec through write, the callback the stb writers take, so
+// files and in-memory size counts go through the same encoder. Only PNG takes a
+// stride; the other stb writers rely on the rendered rows being packed.
+static bool encodeImage(const Image &image, ImageCodec codec, int jpegQuality, stbi_write_func *write, void *context) {
+    const int width = image.getWidth();
+    const int height = image.getHeight();
+    void *pixels = const_cast<uint8_t *>(image.row(0));
+    switch (codec) {
+    case ImageCodec::JPEG:
+        return stbi_write_jpg_to_func(write, context, width, height, 3, pixels, jpegQuality);
+    case ImageCodec::BMP:
+        return stbi_write_bmp_to_func(write, context, width, height, 3, pixels);
+    case ImageCodec::TGA:
+        return stbi_write_tga_to_func(write, context, width, height, 3, pixels);
+    case ImageCodec::PPM: {
+        // A text header and the rows as they are, with no encoder in the way
+        std::string header = ppmHeader(width, height);
+        write(context, &header[0], static_cast<int>(header.size()));
+        for (int y = 0; y < height; ++y)
+            write(context, const_cast<uint8_t *>(image.row(y)), 3 * width);
+        return true;
+    }
+    case ImageCodec::QOI: {
+        std::vector<uint8_t> bytes = QoiCodec::encode(image);
+        const size_t chunk = 1 << 30;
+        for (size_t at = 0; at < bytes.size(); at += chunk)
+            write(context, bytes.data() + at, static_cast<int>(std::min(chunk, bytes.size() - at)));
+        return true;
+    }
+    case ImageCodec::PNG:
+        break;
+    }
+    return stbi_write_png_to_func(write, context, width, height, 3, pixels, static_cast<int>(image.getStride()));
+}
+
+bool ImageIO::saveImage(const std::string &path, Quadtree *tree, bool drawOutline, RunStats *stats, int jpegQuality) {
+    if (!tree || tree->getNodes().empty()) {
         cerr << "Invalid quadtree.\n";
         return false;
     }
 
-    int width = tree->getWidth();
-    int height = tree->getHeight();
-    int channels = 3;
-    std::vector<unsigned char> imageData(width * height * channels, 255);
-
-    auto setPixel = [&](int x, int y, const Color &color) {
-        int idx = (y * width + x) * 3;
-        imageData[idx + 0] = color.r;
-        imageData[idx + 1] = color.g;
-        imageData[idx + 2] = color.b;
-    };
-
-    std::function<void(QuadtreeNode*)> drawNode = [&](QuadtreeNode *node) {
-        if (!node) return;
-        if (node->is_leaf) {
-            for (int y = node->y; y < node->y + node->height; ++y)
-                for (int x = node->x; x < node->x + node->width; ++x)
-                    setPixel(x, y, node->color);
-
-            if (drawOutline) {
-                Color black(0, 0, 0);
-                for (int x = node->x; x < node->x + node->width; ++x) {
-                    setPixel(x, node->y, black);
-                    setPixel(x, node->y + node->height - 1, black);
-                }
-                for (int y = node->y; y < node->y + node->height; ++y) {
-                    setPixel(node->x, y, black);
-                    setPixel(node->x + node->width - 1, y, black);
-                }
-            }
-        } else {
-            for (int i = 0; i < 4; ++i)
-                drawNode(node->children[i]);
-        }
-    };
-
-    drawNode(tree->getRoot());
+    ImageCodec codec;
+    if (!codecFor(path, codec)) {
+        cerr << "Unsupported output format: " << path << endl;
+        return false;
+    }
 
-    int success = stbi_write_png(path.c_str(), width, height, channels, imageData.data(), width * channels);
+    bool success;
+    if (codec == ImageCodec::PPM) {
+        success = savePpm(path, *tree, drawOutline, stats);
+    } else {
+        Image image;
+        {
+            RunStats::Scope timer(stats, RunStats::RENDER);
+            image = renderTree(*tree, drawOutline);
+        }
+        RunStats::Scope timer(stats, RunStats::ENCODE);
+        ofstream out(path, ios::binary);
+        auto append = [](void *context, void *data, int size) {
+            static_cast<ofstream *>(context)->write(static_cast<const char *>(data), size);
+        };
+        success = out && encodeImage(image, codec, jpegQuality, append, &out);
+        out.close();
+        success = success && out;
+    }
     if (!success) {
         cerr << "Failed to write image: " << path << endl;
         return false;
     }
 
+    if (stats) {
+        uint64_t bytes = getFileSize(path);
+        stats->addEncode(bytes);
+        stats->addWritten(bytes);
+    }
     return true;
 }
 
-long ImageIO::getFileSize(const std::string &path) {
+int64_t ImageIO::encodedSize(const Quadtree *tree, ImageCodec codec, int jpegQuality, RunStats *stats) {
+    if (!tree || tree->getNodes().empty()) return -1;
+
+    // The encoder streams its output through the callback, which only counts it
+    Image image;
+    {
+        RunStats::Scope timer(stats, RunStats::RENDER);
+        image = renderTree(*tree, false);
+    }
+    RunStats::Scope timer(stats, RunStats::ENCODE);
+    int64_t size = 0;
+    auto count = [](void *context, void *, int size) { *static_cast<int64_t *>(context) += size; };
+    if (!encodeImage(image, codec, jpegQuality, count, &size))
+        return -1;
+    if (stats) stats->addEncode(size);
+    return size;
+}
+
+int64_t ImageIO::getFileSize(const std::string &path) {
     return std::filesystem::file_size(path);
 }
\ No newline at end of file
@@ -0,0 +1,96 @@
+#include "ImageQuality.hpp"
+#include "MetricKernels.hpp"
+#include "ThreadPool.hpp"
+#include <algorithm>
+#include <cstdint>
+#include <stdexcept>
+#include <vector>
+
+static const double CHANNEL_WEIGHTS[3] = {0.2125, 0.7154, 0.0721};
+
+// Window rows per task. Bands are fixed rather than one per thread, and summed in
+// order, so the result does not depend on the thread count.
+static const int BAND_ROWS = 64;
+
+// SSIM of the whole image as a single window, in doubles
+static double ssimSingleWindow(const Image& a, const Image& b) {
+    const double C1 = 6.5025, C2 = 58.5225;
+    const double n = static_cast<double>(a.getWidth()) * a.getHeight();
+    double total = 0.0;
+    for (int ch = 0; ch < 3; ++ch) {
+        double sx = 0, sy = 0, sxx = 0, syy = 0, sxy = 0;
+        for (int y = 0; y < a.getHeight(); ++y)
+            for (int x = 0; x < a.getWidth(); ++x) {
+                double vx = a.pixel(x, y)[ch], vy = b.pixel(x, y)[ch];
+                sx += vx, sy += vy, sxx += vx * vx, syy += vy * vy, sxy += vx * vy;
+            }
+        double mx = sx / n, my = sy / n;
+        double varX = sxx / n - mx * mx, varY = syy / n - my * my, cov = sxy / n - mx * my;
+        total += CHANNEL_WEIGHTS[ch] * (2 * mx * my + C1) * (2 * cov + C2) /
+                 ((mx * mx + my * my + C1) * (varX + varY + C2));
+    }
+    return total / (CHANNEL_WEIGHTS[0] + CHANNEL_WEIGHTS[1] + CHANNEL_WEIGHTS[2]);
+}
+
+double ImageQuality::ssim(const Image& original, const Image& compressed, ThreadPool* pool) {
+    const int width = original.getWidth(), height = original.getHeight();
+    if (compressed.getWidth() != width || compressed.getHeight() != height)
+        throw std::invalid_argument("SSIM needs two images of the same size");
+    if (original.empty()) return 1.0;
+
+    const int window = MetricKernels::SSIM_WINDOW;
+    if (width < window || height < window) return ssimSingleWindow(original, compressed);
+
+    // The window sums are a box filter taken in two passes, like an integral image
+    // but a few rows wide: per byte column, sums over the window's rows slide down
+    // the band one row at a time; across a row, the kernel adds up window columns.
+    const int rowBytes = 3 * width;
+    const int windowRows = height - window + 1;
+    const int windowBytes = 3 * (width - window + 1);
+    const int bands = (windowRows + BAND_ROWS - 1) / BAND_ROWS;
+    const MetricKernels& kernels = MetricKernels::active();
+    const std::vector<uint8_t> blank(rowBytes, 0);
+    std::vector<double> bandSums(3 * static_cast<size_t>(bands), 0.0);
+
+    auto scoreBands = [&](int begin, int end) {
+        std::vector<int32_t> columns(5 * static_cast<size_t>(rowBytes));
+        int32_t* const sums[5] = {&columns[0], &columns[rowBytes], &columns[2 * rowBytes], &columns[3 * rowBytes],
+                                  &columns[4 * rowBytes]};
+        std::vector<float> scores(windowBytes);
+
+        for (int band = begin; band < end; ++band) {
+            const int top = band * BAND_ROWS, bottom = std::min(windowRows, top + BAND_ROWS);
+            std::fill(columns.begin(), columns.end(), 0);
+            for (int y = top; y < top + window; ++y)
+                kernels.slideColumns(original.row(y), compressed.row(y), blank.data(), blank.data(), rowBytes, sums);
+
+            double* total = &bandSums[3 * static_cast<size_t>(band)];
+            for (int y = top; y < bottom; ++y) {
+                if (y > top)
+                    kernels.slideColumns(original.row(y + window - 1), compressed.row(y + window - 1),
+                                         original.row(y - 1), compressed.row(y - 1), rowBytes, sums);
+                kernels.ssimWindows(sums, windowBytes, scores.data());
+
+                // Four windows at a time keeps twelve additions in flight
+                double lanes[12] = {};
+                int i = 0;
+                for (; i + 12 <= windowBytes; i += 12)
+                    for (int k = 0; k < 12; ++k) lanes[k] += scores[i + k];
+                for (; i < windowBytes; i += 3)
+                    for (int ch = 0; ch < 3; ++ch) lanes[ch] += scores[i + ch];
+                for (int k = 0; k < 12; ++k) total[k % 3] += lanes[k];
+            }
+        }
+    };
+    if (pool && pool->size() > 1) pool->parallelFor(0, bands, scoreBands);
+    else scoreBands(0, bands);
+
+    double channel[3] = {0.0, 0.0, 0.0};
+    for (int band = 0; band < bands; ++band)
+        for (int ch = 0; ch < 3; ++ch) channel[ch] += bandSums[3 * static_cast<size_t>(band) + ch];
+
+    const double windows = static_cast<double>(windowRows) * (width - window + 1);
+    double total = 0.0;
+    for (int ch = 0; ch < 3; ++ch) total += CHANNEL_WEIGHTS[ch] * channel[ch] / windows;
+    return total / (CHANNEL_WEIGHTS[0] + CHANNEL_WEIGHTS[1] + CHANNEL_WEIGHTS[2]);
+}
@@ -0,0 +1,52 @@
+#include "IntegralImage.hpp"
+#include "ThreadPool.hpp"
+
+// Splits [0, count) into contiguous chunks across the pool, or runs it inline
+template <typename Fn>
+static void parallelChunks(ThreadPool* pool, int count, Fn fn) {
+    if (!pool || pool->size() <= 1 || count < 128) {
+        fn(0, count);
+        return;
+    }
+    pool->parallelFor(0, count, fn);
+}
+
+IntegralImage::IntegralImage() : width(0), height(0) {}
+
+void IntegralImage::build(const Image& pixels, ThreadPool* pool) {
+    height = pixels.getHeight();
+    width = pixels.getWidth();
+    table.assign(static_cast<size_t>(width + 1) * (height + 1), Entry{});
+
+    // Row pass: prefix sums along each row independently.
+    parallelChunks(pool, height, [&](int begin, int end) {
+        for (int y = begin; y < end; ++y) {
+            Entry* row = &table[static_cast<size_t>(y + 1) * (width + 1)];
+            const uint8_t* src = pixels.row(y);
+            for (int x = 0; x < width; ++x) {
+                const uint64_t v[3] = { src[3 * x], src[3 * x + 1], src[3 * x + 2] };
+                for (int ch = 0; ch < 3; ++ch) {
+                    row[x + 1].sum[ch] = row[x].sum[ch] + v[ch];
+                    row[x + 1].sumSq[ch] = row[x].sumSq[ch] + v[ch] * v[ch];
+                }
+            }
+        }
+    });
+
+    // Column pass: accumulate rows downwards, each worker owning a band of columns.
+    parallelChunks(pool, width + 1, [&](int begin, int end) {
+        for (int y = 1; y <= height; ++y) {
+            Entry* row = &table[static_cast<size_t>(y) * (width + 1)];
+            const Entry* above = row - (width + 1);
+            for (int x = begin; x < end; ++x)
+                for (int ch = 0; ch < 3; ++ch) {
+                    row[x].sum[ch] += above[x].sum[ch];
+                    row[x].sumSq[ch] += above[x].sumSq[ch];
+                }
+        }
+    });
+}
+
+bool IntegralImage::matches(int width, int height) const {
+    return !table.empty() && this->width == width && this->height == height;
+}
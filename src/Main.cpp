@@ -1,16 +1,162 @@
 // src/main.cpp
 
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
 #include <iostream>
+#include <thread>
 #include "ImageCompressor.hpp"
 
-int main() {
+static void printUsage(const char* program) {
+    std::cerr << "Usage: " << program << " [--threads N] [--parallel-area PIXELS] [--parallel-depth D] [--tolerance R]\n"
+              << "       [--sweep T1,T2,...] [--leaves N] [--nodes N] [--priority error|area]\n"
+              << "       [--search threshold|rd] [--lambda L] [--search-width K]\n"
+              << "       [--estimate on|off] [--psnr DB] [--ssim S] [--stats-json PATH] [--tile-budget MB]\n"
+              << "       [--jpeg-quality Q]\n"
+              << "  --threads N              worker threads for the build, 0 = all cores (default), 1 = serial, at most 4 per core\n"
+              << "  --parallel-area PIXELS   blocks smaller than this are built serially (default 16384)\n"
+              << "  --parallel-depth D       blocks deeper than this are built serially (default 6, at most 32)\n"
+              << "  --tolerance R            target mode accepts ratios up to R above the target (default 0.005)\n"
+              << "  --sweep T1,T2,...        print leaves, size estimate and PSNR for each threshold from one build\n"
+              << "  --leaves N               split the worst leaf first until N leaves; replaces the target search\n"
+              << "  --nodes N                the same with a budget in nodes\n"
+              << "  --priority error|area    order splits by error (default) or by error x block area\n"
+              << "  --search threshold|rd    target mode bisects thresholds (default) or the rate-distortion curve\n"
+              << "  --lambda L               prune the full tree to minimise squared error + L * bits; replaces the target search\n"
+              << "  --estimate on|off        target mode steps on estimated sizes and encodes only to confirm (default on)\n"
+              << "  --psnr DB                smallest cut of the full tree with at least this PSNR; replaces the target search\n"
+              << "  --ssim S                 the same for the mean block SSIM (0-1); with --psnr both must hold\n"
+              << "  --stats-json PATH        also write the report's phase timings and counters as JSON\n"
+              << "  --jpeg-quality Q         quality (1-100) of .jpg/.jpeg output, in the target search too (default 90)\n"
+              << "  --tile-budget MB         read and build the image in tiles using about MB of memory; threshold only.\n"
+              << "                           The tree is held whole, and only .ppm output is written in bands: other\n"
+              << "                           formats are rendered whole, so their memory grows with the image\n"
+              << "  --search-width K         target mode tries K thresholds at once per round, 0 = one per thread (default 1),\n"
+              << "                           at most 4 per core\n"
+              << "Only one of --leaves/--nodes, --psnr/--ssim, --lambda/--search rd and --tile-budget may be given.\n";
+}
+
+// MB; the budget is taken in bytes, so this keeps it well inside 64 bits
+static const long long MAX_TILE_BUDGET = 1LL << 30;
+// No block of an int-sized image is split deeper than this
+static const long long MAX_PARALLEL_DEPTH = 32;
+
+// Threads, and thresholds tried at once, each of which builds a tree of its own:
+// a few per core still pays when some wait, many more only cost memory and switching
+static long long maxThreads() {
+    return 4LL * std::max(1u, std::thread::hardware_concurrency());
+}
+
+static bool parseOptions(int argc, char* argv[], CompressorOptions& options) {
+    for (int i = 1; i < argc; ++i) {
+        const char* arg = argv[i];
+        if (i + 1 >= argc) return false;
+        char* end = nullptr;
+        const char* text = argv[++i];
+        if (std::strcmp(arg, "--tolerance") == 0) {
+            options.sizeTolerance = std::strtod(text, &end);
+            if (*end != '\0' || options.sizeTolerance < 0) return false;
+            continue;
+        }
+        if (std::strcmp(arg, "--sweep") == 0) {
+            for (const char* p = text; *p; p = *end == ',' ? end + 1 : end) {
+                options.sweepThresholds.push_back(std::strtod(p, &end));
+                if (end == p || (*end != ',' && *end != '\0')) return false;
+            }
+            continue;
+        }
+        if (std::strcmp(arg, "--lambda") == 0) {
+            options.lambda = std::strtod(text, &end);
+            if (*end != '\0' || options.lambda < 0) return false;
+            continue;
+        }
+        if (std::strcmp(arg, "--stats-json") == 0) {
+            options.statsJson = text;
+            continue;
+        }
+        if (std::strcmp(arg, "--psnr") == 0) {
+            options.targetPsnr = std::strtod(text, &end);
+            if (*end != '\0' || options.targetPsnr < 0) return false;
+            continue;
+        }
+        if (std::strcmp(arg, "--ssim") == 0) {
+            options.targetSsim = std::strtod(text, &end);
+            if (*end != '\0' || options.targetSsim < 0 || options.targetSsim > 1) return false;
+            continue;
+        }
+        if (std::strcmp(arg, "--search") == 0) {
+            if (std::strcmp(text, "rd") == 0) options.rateDistortion = true;
+            else if (std::strcmp(text, "threshold") == 0) options.rateDistortion = false;
+            else return false;
+            continue;
+        }
+        if (std::strcmp(arg, "--estimate") == 0) {
+            if (std::strcmp(text, "on") == 0) options.estimateSizes = true;
+            else if (std::strcmp(text, "off") == 0) options.estimateSizes = false;
+            else return false;
+            continue;
+        }
+        if (std::strcmp(arg, "--priority") == 0) {
+            if (std::strcmp(text, "area") == 0) options.budgetByArea = true;
+            else if (std::strcmp(text, "error") == 0) options.budgetByArea = false;
+            else return false;
+            continue;
+        }
+
+        long long value = std::strtoll(text, &end, 10);
+        if (*end != '\0' || value < 0) return false;
+
+        if (std::strcmp(arg, "--threads") == 0 && value <= maxThreads()) options.threads = static_cast<int>(value);
+        else if (std::strcmp(arg, "--parallel-area") == 0) options.parallelMinArea = value;
+        else if (std::strcmp(arg, "--parallel-depth") == 0 && value <= MAX_PARALLEL_DEPTH) options.parallelMaxDepth = static_cast<int>(value);
+        else if (std::strcmp(arg, "--leaves") == 0) options.leafBudget = value;
+        else if (std::strcmp(arg, "--nodes") == 0) options.nodeBudget = value;
+        else if (std::strcmp(arg, "--search-width") == 0 && value <= maxThreads()) options.searchWidth = static_cast<int>(value);
+        else if (std::strcmp(arg, "--tile-budget") == 0 && value <= MAX_TILE_BUDGET) options.tileBudget = value;
+        else if (std::strcmp(arg, "--jpeg-quality") == 0 && value >= 1 && value <= 100) options.jpegQuality = static_cast<int>(value);
+        else return false;
+    }
+
+    // The build modes replace the target search and one another, so at most one may be
+    // asked for; --leaves with --nodes and --psnr with --ssim share a mode, and --lambda
+    // is a point of the --search rd curve
+    const char* const modes[] = {
+        options.tileBudget > 0 ? "--tile-budget" : nullptr,
+        options.leafBudget > 0 ? "--leaves" : options.nodeBudget > 0 ? "--nodes" : nullptr,
+        options.targetPsnr > 0 ? "--psnr" : options.targetSsim > 0 ? "--ssim" : nullptr,
+        options.lambda >= 0 ? "--lambda" : options.rateDistortion ? "--search rd" : nullptr,
+    };
+    const char* mode = nullptr;
+    for (const char* flag : modes) {
+        if (!flag) continue;
+        if (mode) {
+            std::cerr << mode << " cannot be combined with " << flag << "\n";
+            return false;
+        }
+        mode = flag;
+    }
+    // A sweep goes with any of them but a tiled build, which never holds the whole image
+    if (options.tileBudget > 0 && !options.sweepThresholds.empty()) {
+        std::cerr << "--tile-budget cannot be combined with --sweep\n";
+        return false;
+    }
+    return true;
+}
+
+int main(int argc, char* argv[]) {
+    CompressorOptions options;
+    if (!parseOptions(argc, argv, options)) {
+        printUsage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
     std::cout << "============================================\n";
     std::cout << "           Welcome to QuaQua Image          \n";
     std::cout << "       Quadtree -- Divide and Conquer       \n";
     std::cout << "============================================\n\n";
 
     try {
-        ImageCompressor compressor;
+        ImageCompressor compressor(options);
         compressor.run();
     } catch (const std::exception& e) {
         std::cerr << "[FATAL ERROR] " << e.what() << "\n";
@@ -18,4 +164,4 @@ int main() {
     }
 
     return EXIT_SUCCESS;
-}
\ No newline at end of file
+}
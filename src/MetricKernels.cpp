@@ -0,0 +1,611 @@
+#include "MetricKernels.hpp"
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define QUAQUA_X86_KERNELS 1
+#include <immintrin.h>
+#endif
+
+// ---------- Scalar ----------
+
+static void sumScalar(const uint8_t* rgb, int count, uint64_t sum[3]) {
+    for (int i = 0; i < count; ++i)
+        for (int ch = 0; ch < 3; ++ch)
+            sum[ch] += rgb[3 * i + ch];
+}
+
+static void sumSquaresScalar(const uint8_t* rgb, int count, uint64_t sumSq[3]) {
+    for (int i = 0; i < count; ++i)
+        for (int ch = 0; ch < 3; ++ch) {
+            uint64_t v = rgb[3 * i + ch];
+            sumSq[ch] += v * v;
+        }
+}
+
+static void splitBelowScalar(const uint8_t* rgb, int count, const int limit[3], uint64_t countBelow[3], uint64_t sumBelow[3]) {
+    for (int i = 0; i < count; ++i)
+        for (int ch = 0; ch < 3; ++ch) {
+            int v = rgb[3 * i + ch];
+            if (v <= limit[ch]) {
+                ++countBelow[ch];
+                sumBelow[ch] += v;
+            }
+        }
+}
+
+static void minMaxScalar(const uint8_t* rgb, int count, int minValue[3], int maxValue[3]) {
+    for (int i = 0; i < count; ++i)
+        for (int ch = 0; ch < 3; ++ch) {
+            int v = rgb[3 * i + ch];
+            minValue[ch] = std::min(minValue[ch], v);
+            maxValue[ch] = std::max(maxValue[ch], v);
+        }
+}
+
+// Scattered increments do not vectorize for 8-bit values, every path shares this loop
+static void histogramScalar(const uint8_t* rgb, int count, uint32_t hist[3][256]) {
+    for (int i = 0; i < count; ++i) {
+        ++hist[0][rgb[3 * i]];
+        ++hist[1][rgb[3 * i + 1]];
+        ++hist[2][rgb[3 * i + 2]];
+    }
+}
+
+static inline void slideColumnsFrom(int begin, const uint8_t* enterX, const uint8_t* enterY, const uint8_t* leaveX,
+                                    const uint8_t* leaveY, int count, int32_t* const sums[5]) {
+    for (int i = begin; i < count; ++i) {
+        int32_t x = enterX[i], y = enterY[i], oldX = leaveX[i], oldY = leaveY[i];
+        sums[0][i] += x - oldX;
+        sums[1][i] += y - oldY;
+        sums[2][i] += x * x - oldX * oldX;
+        sums[3][i] += y * y - oldY * oldY;
+        sums[4][i] += x * y - oldX * oldY;
+    }
+}
+
+static void slideColumnsScalar(const uint8_t* enterX, const uint8_t* enterY, const uint8_t* leaveX,
+                               const uint8_t* leaveY, int count, int32_t* const sums[5]) {
+    slideColumnsFrom(0, enterX, enterY, leaveX, leaveY, count, sums);
+}
+
+// SSIM with every term scaled by the window's area squared, which keeps the
+// means and (co)variances exact integers up to the last step: sums of an 8x8
+// window stay below 2^23, and the products below 2^30.
+static const int SSIM_AREA = MetricKernels::SSIM_WINDOW * MetricKernels::SSIM_WINDOW;
+static const float SSIM_C1 = 6.5025f * SSIM_AREA * SSIM_AREA;  // (0.01 * 255)^2
+static const float SSIM_C2 = 58.5225f * SSIM_AREA * SSIM_AREA; // (0.03 * 255)^2
+
+static inline float ssimFromSums(int32_t sx, int32_t sy, int32_t sxx, int32_t syy, int32_t sxy) {
+    float means = static_cast<float>(2 * sx * sy);
+    float meanSquares = static_cast<float>(sx * sx + sy * sy);
+    float covariance = static_cast<float>(2 * (SSIM_AREA * sxy - sx * sy));
+    float variances = static_cast<float>(SSIM_AREA * sxx - sx * sx + (SSIM_AREA * syy - sy * sy));
+    return (means + SSIM_C1) * (covariance + SSIM_C2) / ((meanSquares + SSIM_C1) * (variances + SSIM_C2));
+}
+
+static inline int32_t windowSum(const int32_t* columns, int i) {
+    int32_t total = 0;
+    for (int k = 0; k < MetricKernels::SSIM_WINDOW; ++k) total += columns[i + 3 * k];
+    return total;
+}
+
+static inline void ssimWindowsFrom(int begin, const int32_t* const sums[5], int count, float* out) {
+    for (int i = begin; i < count; ++i)
+        out[i] = ssimFromSums(windowSum(sums[0], i), windowSum(sums[1], i), windowSum(sums[2], i),
+                              windowSum(sums[3], i), windowSum(sums[4], i));
+}
+
+static void ssimWindowsScalar(const int32_t* const sums[5], int count, float* out) {
+    ssimWindowsFrom(0, sums, count, out);
+}
+
+#ifdef QUAQUA_X86_KERNELS
+
+// Three consecutive loads of L bytes, each widened to L int lanes, hold L pixels;
+// lane i of vector k is channel (k * L + i) % 3.
+// Rows shorter than two vector steps go straight to the scalar loop, the lane setup
+// and reduction would cost more than they save.
+template <int L, typename T>
+static void addLanes(const T lanes[3][L], uint64_t out[3]) {
+    for (int k = 0; k < 3; ++k)
+        for (int i = 0; i < L; ++i)
+            out[(k * L + i) % 3] += lanes[k][i];
+}
+
+template <int L>
+static void laneLimits(const int limit[3], int out[3][L]) {
+    for (int k = 0; k < 3; ++k)
+        for (int i = 0; i < L; ++i)
+            out[k][i] = limit[(k * L + i) % 3];
+}
+
+template <int L>
+static void foldMinMax(const int mins[3][L], const int maxs[3][L], int minValue[3], int maxValue[3]) {
+    for (int k = 0; k < 3; ++k)
+        for (int i = 0; i < L; ++i) {
+            int ch = (k * L + i) % 3;
+            minValue[ch] = std::min(minValue[ch], mins[k][i]);
+            maxValue[ch] = std::max(maxValue[ch], maxs[k][i]);
+        }
+}
+
+// ---------- SSE2 ----------
+
+__attribute__((target("sse2")))
+static inline __m128i load4(const uint8_t* p) {
+    int32_t bytes;
+    std::memcpy(&bytes, p, sizeof(bytes));
+    const __m128i zero = _mm_setzero_si128();
+    return _mm_unpacklo_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128(bytes), zero), zero);
+}
+
+__attribute__((target("sse2")))
+static void sumSse2(const uint8_t* rgb, int count, uint64_t sum[3]) {
+    if (count < 8) return sumScalar(rgb, count, sum);
+    __m128i acc[3] = {_mm_setzero_si128(), _mm_setzero_si128(), _mm_setzero_si128()};
+    int i = 0;
+    for (; i + 4 <= count; i += 4)
+        for (int k = 0; k < 3; ++k)
+            acc[k] = _mm_add_epi32(acc[k], load4(rgb + 3 * i + 4 * k));
+
+    int32_t lanes[3][4];
+    for (int k = 0; k < 3; ++k) _mm_storeu_si128(reinterpret_cast<__m128i*>(lanes[k]), acc[k]);
+    addLanes<4>(lanes, sum);
+    sumScalar(rgb + 3 * i, count - i, sum);
+}
+
+__attribute__((target("sse2")))
+static void sumSquaresSse2(const uint8_t* rgb, int count, uint64_t sumSq[3]) {
+    if (count < 8) return sumSquaresScalar(rgb, count, sumSq);
+    __m128i even[3], odd[3];
+    for (int k = 0; k < 3; ++k) even[k] = odd[k] = _mm_setzero_si128();
+    int i = 0;
+    for (; i + 4 <= count; i += 4)
+        for (int k = 0; k < 3; ++k) {
+            __m128i v = load4(rgb + 3 * i + 4 * k);
+            __m128i high = _mm_srli_epi64(v, 32);
+            even[k] = _mm_add_epi64(even[k], _mm_mul_epu32(v, v));
+            odd[k] = _mm_add_epi64(odd[k], _mm_mul_epu32(high, high));
+        }
+
+    uint64_t lanes[3][4];
+    for (int k = 0; k < 3; ++k) {
+        uint64_t e[2], o[2];
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(e), even[k]);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(o), odd[k]);
+        for (int j = 0; j < 2; ++j) {
+            lanes[k][2 * j] = e[j];
+            lanes[k][2 * j + 1] = o[j];
+        }
+    }
+    addLanes<4>(lanes, sumSq);
+    sumSquaresScalar(rgb + 3 * i, count - i, sumSq);
+}
+
+__attribute__((target("sse2")))
+static void splitBelowSse2(const uint8_t* rgb, int count, const int limit[3], uint64_t countBelow[3], uint64_t sumBelow[3]) {
+    if (count < 8) return splitBelowScalar(rgb, count, limit, countBelow, sumBelow);
+    int limits[3][4];
+    laneLimits<4>(limit, limits);
+    __m128i bound[3], cnt[3], acc[3];
+    for (int k = 0; k < 3; ++k) {
+        bound[k] = _mm_add_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(limits[k])), _mm_set1_epi32(1));
+        cnt[k] = acc[k] = _mm_setzero_si128();
+    }
+    int i = 0;
+    for (; i + 4 <= count; i += 4)
+        for (int k = 0; k < 3; ++k) {
+            __m128i v = load4(rgb + 3 * i + 4 * k);
+            __m128i below = _mm_cmpgt_epi32(bound[k], v);
+            cnt[k] = _mm_sub_epi32(cnt[k], below);
+            acc[k] = _mm_add_epi32(acc[k], _mm_and_si128(below, v));
+        }
+
+    int32_t counts[3][4], sums[3][4];
+    for (int k = 0; k < 3; ++k) {
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(counts[k]), cnt[k]);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(sums[k]), acc[k]);
+    }
+    addLanes<4>(counts, countBelow);
+    addLanes<4>(sums, sumBelow);
+    splitBelowScalar(rgb + 3 * i, count - i, limit, countBelow, sumBelow);
+}
+
+__attribute__((target("sse2")))
+static void minMaxSse2(const uint8_t* rgb, int count, int minValue[3], int maxValue[3]) {
+    if (count < 8) return minMaxScalar(rgb, count, minValue, maxValue);
+    int mins[3][4], maxs[3][4];
+    laneLimits<4>(minValue, mins);
+    laneLimits<4>(maxValue, maxs);
+    __m128i lo[3], hi[3];
+    for (int k = 0; k < 3; ++k) {
+        lo[k] = _mm_loadu_si128(reinterpret_cast<const __m128i*>(mins[k]));
+        hi[k] = _mm_loadu_si128(reinterpret_cast<const __m128i*>(maxs[k]));
+    }
+    int i = 0;
+    for (; i + 4 <= count; i += 4)
+        for (int k = 0; k < 3; ++k) {
+            __m128i v = load4(rgb + 3 * i + 4 * k);
+            __m128i less = _mm_cmpgt_epi32(lo[k], v);
+            __m128i more = _mm_cmpgt_epi32(v, hi[k]);
+            lo[k] = _mm_or_si128(_mm_and_si128(less, v), _mm_andnot_si128(less, lo[k]));
+            hi[k] = _mm_or_si128(_mm_and_si128(more, v), _mm_andnot_si128(more, hi[k]));
+        }
+    for (int k = 0; k < 3; ++k) {
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(mins[k]), lo[k]);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(maxs[k]), hi[k]);
+    }
+    foldMinMax<4>(mins, maxs, minValue, maxValue);
+    minMaxScalar(rgb + 3 * i, count - i, minValue, maxValue);
+}
+
+// ---------- AVX2 ----------
+
+__attribute__((target("avx2")))
+static inline __m256i load8(const uint8_t* p) {
+    return _mm256_cvtepu8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(p)));
+}
+
+__attribute__((target("avx2")))
+static void sumAvx2(const uint8_t* rgb, int count, uint64_t sum[3]) {
+    if (count < 16) return sumScalar(rgb, count, sum);
+    __m256i acc[3] = {_mm256_setzero_si256(), _mm256_setzero_si256(), _mm256_setzero_si256()};
+    int i = 0;
+    for (; i + 8 <= count; i += 8)
+        for (int k = 0; k < 3; ++k)
+            acc[k] = _mm256_add_epi32(acc[k], load8(rgb + 3 * i + 8 * k));
+
+    int32_t lanes[3][8];
+    for (int k = 0; k < 3; ++k) _mm256_storeu_si256(reinterpret_cast<__m256i*>(lanes[k]), acc[k]);
+    addLanes<8>(lanes, sum);
+    sumScalar(rgb + 3 * i, count - i, sum);
+}
+
+__attribute__((target("avx2")))
+static void sumSquaresAvx2(const uint8_t* rgb, int count, uint64_t sumSq[3]) {
+    if (count < 16) return sumSquaresScalar(rgb, count, sumSq);
+    __m256i even[3], odd[3];
+    for (int k = 0; k < 3; ++k) even[k] = odd[k] = _mm256_setzero_si256();
+    int i = 0;
+    for (; i + 8 <= count; i += 8)
+        for (int k = 0; k < 3; ++k) {
+            __m256i v = load8(rgb + 3 * i + 8 * k);
+            __m256i high = _mm256_srli_epi64(v, 32);
+            even[k] = _mm256_add_epi64(even[k], _mm256_mul_epu32(v, v));
+            odd[k] = _mm256_add_epi64(odd[k], _mm256_mul_epu32(high, high));
+        }
+
+    uint64_t lanes[3][8];
+    for (int k = 0; k < 3; ++k) {
+        uint64_t e[4], o[4];
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(e), even[k]);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(o), odd[k]);
+        for (int j = 0; j < 4; ++j) {
+            lanes[k][2 * j] = e[j];
+            lanes[k][2 * j + 1] = o[j];
+        }
+    }
+    addLanes<8>(lanes, sumSq);
+    sumSquaresScalar(rgb + 3 * i, count - i, sumSq);
+}
+
+__attribute__((target("avx2")))
+static void splitBelowAvx2(const uint8_t* rgb, int count, const int limit[3], uint64_t countBelow[3], uint64_t sumBelow[3]) {
+    if (count < 16) return splitBelowScalar(rgb, count, limit, countBelow, sumBelow);
+    int limits[3][8];
+    laneLimits<8>(limit, limits);
+    __m256i bound[3], cnt[3], acc[3];
+    for (int k = 0; k < 3; ++k) {
+        bound[k] = _mm256_add_epi32(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(limits[k])), _mm256_set1_epi32(1));
+        cnt[k] = acc[k] = _mm256_setzero_si256();
+    }
+    int i = 0;
+    for (; i + 8 <= count; i += 8)
+        for (int k = 0; k < 3; ++k) {
+            __m256i v = load8(rgb + 3 * i + 8 * k);
+            __m256i below = _mm256_cmpgt_epi32(bound[k], v);
+            cnt[k] = _mm256_sub_epi32(cnt[k], below);
+            acc[k] = _mm256_add_epi32(acc[k], _mm256_and_si256(below, v));
+        }
+
+    int32_t counts[3][8], sums[3][8];
+    for (int k = 0; k < 3; ++k) {
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(counts[k]), cnt[k]);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(sums[k]), acc[k]);
+    }
+    addLanes<8>(counts, countBelow);
+    addLanes<8>(sums, sumBelow);
+    splitBelowScalar(rgb + 3 * i, count - i, limit, countBelow, sumBelow);
+}
+
+__attribute__((target("avx2")))
+static void minMaxAvx2(const uint8_t* rgb, int count, int minValue[3], int maxValue[3]) {
+    if (count < 16) return minMaxScalar(rgb, count, minValue, maxValue);
+    int mins[3][8], maxs[3][8];
+    laneLimits<8>(minValue, mins);
+    laneLimits<8>(maxValue, maxs);
+    __m256i lo[3], hi[3];
+    for (int k = 0; k < 3; ++k) {
+        lo[k] = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(mins[k]));
+        hi[k] = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(maxs[k]));
+    }
+    int i = 0;
+    for (; i + 8 <= count; i += 8)
+        for (int k = 0; k < 3; ++k) {
+            __m256i v = load8(rgb + 3 * i + 8 * k);
+            lo[k] = _mm256_min_epi32(lo[k], v);
+            hi[k] = _mm256_max_epi32(hi[k], v);
+        }
+    for (int k = 0; k < 3; ++k) {
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(mins[k]), lo[k]);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(maxs[k]), hi[k]);
+    }
+    foldMinMax<8>(mins, maxs, minValue, maxValue);
+    minMaxScalar(rgb + 3 * i, count - i, minValue, maxValue);
+}
+
+__attribute__((target("avx2")))
+static void slideColumnsAvx2(const uint8_t* enterX, const uint8_t* enterY, const uint8_t* leaveX,
+                             const uint8_t* leaveY, int count, int32_t* const sums[5]) {
+    int i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m256i x = load8(enterX + i), y = load8(enterY + i), oldX = load8(leaveX + i), oldY = load8(leaveY + i);
+        const __m256i change[5] = {
+            _mm256_sub_epi32(x, oldX),
+            _mm256_sub_epi32(y, oldY),
+            _mm256_sub_epi32(_mm256_mullo_epi32(x, x), _mm256_mullo_epi32(oldX, oldX)),
+            _mm256_sub_epi32(_mm256_mullo_epi32(y, y), _mm256_mullo_epi32(oldY, oldY)),
+            _mm256_sub_epi32(_mm256_mullo_epi32(x, y), _mm256_mullo_epi32(oldX, oldY)),
+        };
+        for (int m = 0; m < 5; ++m) {
+            __m256i* column = reinterpret_cast<__m256i*>(sums[m] + i);
+            _mm256_storeu_si256(column, _mm256_add_epi32(_mm256_loadu_si256(column), change[m]));
+        }
+    }
+    slideColumnsFrom(i, enterX, enterY, leaveX, leaveY, count, sums);
+}
+
+__attribute__((target("avx2")))
+static inline __m256i windowSum8(const int32_t* columns) {
+    __m256i total = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(columns));
+    for (int k = 1; k < MetricKernels::SSIM_WINDOW; ++k)
+        total = _mm256_add_epi32(total, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(columns + 3 * k)));
+    return total;
+}
+
+__attribute__((target("avx2")))
+static void ssimWindowsAvx2(const int32_t* const sums[5], int count, float* out) {
+    const __m256i area = _mm256_set1_epi32(SSIM_AREA);
+    const __m256 c1 = _mm256_set1_ps(SSIM_C1), c2 = _mm256_set1_ps(SSIM_C2);
+    int i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m256i sx = windowSum8(sums[0] + i), sy = windowSum8(sums[1] + i);
+        __m256i sxx = windowSum8(sums[2] + i), syy = windowSum8(sums[3] + i), sxy = windowSum8(sums[4] + i);
+
+        __m256i xy = _mm256_mullo_epi32(sx, sy);
+        __m256i xx = _mm256_mullo_epi32(sx, sx), yy = _mm256_mullo_epi32(sy, sy);
+        __m256 means = _mm256_cvtepi32_ps(_mm256_add_epi32(xy, xy));
+        __m256 meanSquares = _mm256_cvtepi32_ps(_mm256_add_epi32(xx, yy));
+        __m256i cov = _mm256_sub_epi32(_mm256_mullo_epi32(area, sxy), xy);
+        __m256 covariance = _mm256_cvtepi32_ps(_mm256_add_epi32(cov, cov));
+        __m256 variances = _mm256_cvtepi32_ps(_mm256_add_epi32(_mm256_sub_epi32(_mm256_mullo_epi32(area, sxx), xx),
+                                                               _mm256_sub_epi32(_mm256_mullo_epi32(area, syy), yy)));
+        __m256 numerator = _mm256_mul_ps(_mm256_add_ps(means, c1), _mm256_add_ps(covariance, c2));
+        __m256 denominator = _mm256_mul_ps(_mm256_add_ps(meanSquares, c1), _mm256_add_ps(variances, c2));
+        _mm256_storeu_ps(out + i, _mm256_div_ps(numerator, denominator));
+    }
+    ssimWindowsFrom(i, sums, count, out);
+}
+
+// ---------- AVX-512 ----------
+
+// GCC 12 flags the undefined-vector idiom inside its own AVX-512 headers
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+
+__attribute__((target("avx512f")))
+static inline __m512i load16(const uint8_t* p) {
+    return _mm512_cvtepu8_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p)));
+}
+
+__attribute__((target("avx512f")))
+static void sumAvx512(const uint8_t* rgb, int count, uint64_t sum[3]) {
+    if (count < 32) return sumScalar(rgb, count, sum);
+    __m512i acc[3] = {_mm512_setzero_si512(), _mm512_setzero_si512(), _mm512_setzero_si512()};
+    int i = 0;
+    for (; i + 16 <= count; i += 16)
+        for (int k = 0; k < 3; ++k)
+            acc[k] = _mm512_add_epi32(acc[k], load16(rgb + 3 * i + 16 * k));
+
+    int32_t lanes[3][16];
+    for (int k = 0; k < 3; ++k) _mm512_storeu_si512(lanes[k], acc[k]);
+    addLanes<16>(lanes, sum);
+    sumScalar(rgb + 3 * i, count - i, sum);
+}
+
+__attribute__((target("avx512f")))
+static void sumSquaresAvx512(const uint8_t* rgb, int count, uint64_t sumSq[3]) {
+    if (count < 32) return sumSquaresScalar(rgb, count, sumSq);
+    __m512i even[3], odd[3];
+    for (int k = 0; k < 3; ++k) even[k] = odd[k] = _mm512_setzero_si512();
+    int i = 0;
+    for (; i + 16 <= count; i += 16)
+        for (int k = 0; k < 3; ++k) {
+            __m512i v = load16(rgb + 3 * i + 16 * k);
+            __m512i high = _mm512_srli_epi64(v, 32);
+            even[k] = _mm512_add_epi64(even[k], _mm512_mul_epu32(v, v));
+            odd[k] = _mm512_add_epi64(odd[k], _mm512_mul_epu32(high, high));
+        }
+
+    uint64_t lanes[3][16];
+    for (int k = 0; k < 3; ++k) {
+        uint64_t e[8], o[8];
+        _mm512_storeu_si512(e, even[k]);
+        _mm512_storeu_si512(o, odd[k]);
+        for (int j = 0; j < 8; ++j) {
+            lanes[k][2 * j] = e[j];
+            lanes[k][2 * j + 1] = o[j];
+        }
+    }
+    addLanes<16>(lanes, sumSq);
+    sumSquaresScalar(rgb + 3 * i, count - i, sumSq);
+}
+
+__attribute__((target("avx512f")))
+static void splitBelowAvx512(const uint8_t* rgb, int count, const int limit[3], uint64_t countBelow[3], uint64_t sumBelow[3]) {
+    if (count < 32) return splitBelowScalar(rgb, count, limit, countBelow, sumBelow);
+    int limits[3][16];
+    laneLimits<16>(limit, limits);
+    const __m512i one = _mm512_set1_epi32(1);
+    __m512i bound[3], cnt[3], acc[3];
+    for (int k = 0; k < 3; ++k) {
+        bound[k] = _mm512_loadu_si512(limits[k]);
+        cnt[k] = acc[k] = _mm512_setzero_si512();
+    }
+    int i = 0;
+    for (; i + 16 <= count; i += 16)
+        for (int k = 0; k < 3; ++k) {
+            __m512i v = load16(rgb + 3 * i + 16 * k);
+            __mmask16 below = _mm512_cmple_epi32_mask(v, bound[k]);
+            cnt[k] = _mm512_mask_add_epi32(cnt[k], below, cnt[k], one);
+            acc[k] = _mm512_mask_add_epi32(acc[k], below, acc[k], v);
+        }
+
+    int32_t counts[3][16], sums[3][16];
+    for (int k = 0; k < 3; ++k) {
+        _mm512_storeu_si512(counts[k], cnt[k]);
+        _mm512_storeu_si512(sums[k], acc[k]);
+    }
+    addLanes<16>(counts, countBelow);
+    addLanes<16>(sums, sumBelow);
+    splitBelowScalar(rgb + 3 * i, count - i, limit, countBelow, sumBelow);
+}
+
+__attribute__((target("avx512f")))
+static void minMaxAvx512(const uint8_t* rgb, int count, int minValue[3], int maxValue[3]) {
+    if (count < 32) return minMaxScalar(rgb, count, minValue, maxValue);
+    int mins[3][16], maxs[3][16];
+    laneLimits<16>(minValue, mins);
+    laneLimits<16>(maxValue, maxs);
+    __m512i lo[3], hi[3];
+    for (int k = 0; k < 3; ++k) {
+        lo[k] = _mm512_loadu_si512(mins[k]);
+        hi[k] = _mm512_loadu_si512(maxs[k]);
+    }
+    int i = 0;
+    for (; i + 16 <= count; i += 16)
+        for (int k = 0; k < 3; ++k) {
+            __m512i v = load16(rgb + 3 * i + 16 * k);
+            lo[k] = _mm512_min_epi32(lo[k], v);
+            hi[k] = _mm512_max_epi32(hi[k], v);
+        }
+    for (int k = 0; k < 3; ++k) {
+        _mm512_storeu_si512(mins[k], lo[k]);
+        _mm512_storeu_si512(maxs[k], hi[k]);
+    }
+    foldMinMax<16>(mins, maxs, minValue, maxValue);
+    minMaxScalar(rgb + 3 * i, count - i, minValue, maxValue);
+}
+
+__attribute__((target("avx512f")))
+static void slideColumnsAvx512(const uint8_t* enterX, const uint8_t* enterY, const uint8_t* leaveX,
+                               const uint8_t* leaveY, int count, int32_t* const sums[5]) {
+    int i = 0;
+    for (; i + 16 <= count; i += 16) {
+        __m512i x = load16(enterX + i), y = load16(enterY + i), oldX = load16(leaveX + i), oldY = load16(leaveY + i);
+        const __m512i change[5] = {
+            _mm512_sub_epi32(x, oldX),
+            _mm512_sub_epi32(y, oldY),
+            _mm512_sub_epi32(_mm512_mullo_epi32(x, x), _mm512_mullo_epi32(oldX, oldX)),
+            _mm512_sub_epi32(_mm512_mullo_epi32(y, y), _mm512_mullo_epi32(oldY, oldY)),
+            _mm512_sub_epi32(_mm512_mullo_epi32(x, y), _mm512_mullo_epi32(oldX, oldY)),
+        };
+        for (int m = 0; m < 5; ++m)
+            _mm512_storeu_si512(sums[m] + i, _mm512_add_epi32(_mm512_loadu_si512(sums[m] + i), change[m]));
+    }
+    slideColumnsFrom(i, enterX, enterY, leaveX, leaveY, count, sums);
+}
+
+__attribute__((target("avx512f")))
+static inline __m512i windowSum16(const int32_t* columns) {
+    __m512i total = _mm512_loadu_si512(columns);
+    for (int k = 1; k < MetricKernels::SSIM_WINDOW; ++k)
+        total = _mm512_add_epi32(total, _mm512_loadu_si512(columns + 3 * k));
+    return total;
+}
+
+__attribute__((target("avx512f")))
+static void ssimWindowsAvx512(const int32_t* const sums[5], int count, float* out) {
+    const __m512i area = _mm512_set1_epi32(SSIM_AREA);
+    const __m512 c1 = _mm512_set1_ps(SSIM_C1), c2 = _mm512_set1_ps(SSIM_C2);
+    int i = 0;
+    for (; i + 16 <= count; i += 16) {
+        __m512i sx = windowSum16(sums[0] + i), sy = windowSum16(sums[1] + i);
+        __m512i sxx = windowSum16(sums[2] + i), syy = windowSum16(sums[3] + i), sxy = windowSum16(sums[4] + i);
+
+        __m512i xy = _mm512_mullo_epi32(sx, sy);
+        __m512i xx = _mm512_mullo_epi32(sx, sx), yy = _mm512_mullo_epi32(sy, sy);
+        __m512 means = _mm512_cvtepi32_ps(_mm512_add_epi32(xy, xy));
+        __m512 meanSquares = _mm512_cvtepi32_ps(_mm512_add_epi32(xx, yy));
+        __m512i cov = _mm512_sub_epi32(_mm512_mullo_epi32(area, sxy), xy);
+        __m512 covariance = _mm512_cvtepi32_ps(_mm512_add_epi32(cov, cov));
+        __m512 variances = _mm512_cvtepi32_ps(_mm512_add_epi32(_mm512_sub_epi32(_mm512_mullo_epi32(area, sxx), xx),
+                                                               _mm512_sub_epi32(_mm512_mullo_epi32(area, syy), yy)));
+        __m512 numerator = _mm512_mul_ps(_mm512_add_ps(means, c1), _mm512_add_ps(covariance, c2));
+        __m512 denominator = _mm512_mul_ps(_mm512_add_ps(meanSquares, c1), _mm512_add_ps(variances, c2));
+        _mm512_storeu_ps(out + i, _mm512_div_ps(numerator, denominator));
+    }
+    ssimWindowsFrom(i, sums, count, out);
+}
+
+#pragma GCC diagnostic pop
+
+#endif
+
+static const MetricKernels scalarKernels = {
+    "scalar", sumScalar, sumSquaresScalar, splitBelowScalar, minMaxScalar, histogramScalar,
+    slideColumnsScalar, ssimWindowsScalar
+};
+
+#ifdef QUAQUA_X86_KERNELS
+static const MetricKernels sse2Kernels = {
+    "sse2", sumSse2, sumSquaresSse2, splitBelowSse2, minMaxSse2, histogramScalar,
+    slideColumnsScalar, ssimWindowsScalar // 32-bit multiplies need SSE4.1
+};
+static const MetricKernels avx2Kernels = {
+    "avx2", sumAvx2, sumSquaresAvx2, splitBelowAvx2, minMaxAvx2, histogramScalar,
+    slideColumnsAvx2, ssimWindowsAvx2
+};
+static const MetricKernels avx512Kernels = {
+    "avx512", sumAvx512, sumSquaresAvx512, splitBelowAvx512, minMaxAvx512, histogramScalar,
+    slideColumnsAvx512, ssimWindowsAvx512
+};
+#endif
+
+static const MetricKernels& chooseKernels() {
+#ifdef QUAQUA_X86_KERNELS
+    int cap = 3;
+    if (const char* env = std::getenv("QUAQUA_SIMD")) {
+        if (std::strcmp(env, "scalar") == 0) cap = 0;
+        else if (std::strcmp(env, "sse2") == 0) cap = 1;
+        else if (std::strcmp(env, "avx2") == 0) cap = 2;
+    }
+
+    __builtin_cpu_init();
+    if (cap >= 3 && __builtin_cpu_supports("avx512f")) return avx512Kernels;
+    if (cap >= 2 && __builtin_cpu_supports("avx2")) return avx2Kernels;
+    if (cap >= 1 && __builtin_cpu_supports("sse2")) return sse2Kernels;
+#endif
+    return scalarKernels;
+}
+
+const MetricKernels& MetricKernels::active() {
+    static const MetricKernels& chosen = chooseKernels();
+    return chosen;
+}
+
+const MetricKernels& MetricKernels::scalar() {
+    return scalarKernels;
+}
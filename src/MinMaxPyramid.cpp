@@ -0,0 +1,68 @@
+#include "MinMaxPyramid.hpp"
+#include <algorithm>
+
+MinMaxPyramid::MinMaxPyramid() {}
+
+void MinMaxPyramid::build(const Image& pixels) {
+    const int height = pixels.getHeight();
+    const int width = pixels.getWidth();
+    grid.build(width, height, MIN_CELL_AREA, 16);
+    levels.assign(grid.levels(), {});
+    if (levels.empty()) return;
+
+    // Finest level straight from the pixels
+    const size_t cells = static_cast<size_t>(1) << (grid.levels() - 1);
+    std::vector<Cell>& finest = levels.back();
+    finest.assign(cells * cells, Cell{{255, 255, 255}, {0, 0, 0}});
+
+    const std::vector<int> colOf = grid.finestColumnOf();
+    const std::vector<int> rowOf = grid.finestRowOf();
+    for (int y = 0; y < height; ++y) {
+        Cell* row = &finest[rowOf[y] * cells];
+        const uint8_t* src = pixels.row(y);
+        for (int x = 0; x < width; ++x) {
+            Cell& cell = row[colOf[x]];
+            const uint8_t* v = src + 3 * x;
+            for (int ch = 0; ch < 3; ++ch) {
+                cell.min[ch] = std::min(cell.min[ch], v[ch]);
+                cell.max[ch] = std::max(cell.max[ch], v[ch]);
+            }
+        }
+    }
+
+    // Every coarser cell covers its four children
+    for (int d = grid.levels() - 2; d >= 0; --d) {
+        const size_t parentCells = static_cast<size_t>(1) << d;
+        const std::vector<Cell>& child = levels[d + 1];
+        std::vector<Cell>& parent = levels[d];
+        parent.resize(parentCells * parentCells);
+
+        for (size_t r = 0; r < parentCells; ++r)
+            for (size_t c = 0; c < parentCells; ++c) {
+                const Cell* top = &child[(2 * r) * (2 * parentCells) + 2 * c];
+                const Cell* bottom = top + 2 * parentCells;
+                Cell& dst = parent[r * parentCells + c];
+                for (int ch = 0; ch < 3; ++ch) {
+                    dst.min[ch] = std::min({top[0].min[ch], top[1].min[ch], bottom[0].min[ch], bottom[1].min[ch]});
+                    dst.max[ch] = std::max({top[0].max[ch], top[1].max[ch], bottom[0].max[ch], bottom[1].max[ch]});
+                }
+            }
+    }
+}
+
+bool MinMaxPyramid::matches(int width, int height) const {
+    return !levels.empty() && grid.width() == width && grid.height() == height;
+}
+
+bool MinMaxPyramid::range(int x, int y, int width, int height, int minValue[3], int maxValue[3]) const {
+    int d;
+    size_t index;
+    if (!grid.locate(x, y, width, height, d, index)) return false;
+
+    const Cell& cell = levels[d][index];
+    for (int ch = 0; ch < 3; ++ch) {
+        minValue[ch] = cell.min[ch];
+        maxValue[ch] = cell.max[ch];
+    }
+    return true;
+}
@@ -0,0 +1,173 @@
+#include "QoiCodec.hpp"
+#include <algorithm>
+#include <cstring>
+
+static const uint8_t OP_INDEX = 0x00; // 00xxxxxx
+static const uint8_t OP_DIFF = 0x40;  // 01rrggbb
+static const uint8_t OP_LUMA = 0x80;  // 10gggggg rrrrbbbb
+static const uint8_t OP_RUN = 0xc0;   // 11xxxxxx
+static const uint8_t OP_RGB = 0xfe;
+static const uint8_t OP_RGBA = 0xff;
+static const uint8_t TAG_MASK = 0xc0;
+static const int HEADER_SIZE = 14;
+static const int MAX_RUN = 62;
+static const uint8_t END_MARKER[8] = {0, 0, 0, 0, 0, 0, 0, 1};
+static const uint64_t MAX_PIXELS = 400000000; // the reference decoder's limit
+
+namespace {
+
+struct Pixel {
+    uint8_t r, g, b, a;
+    bool operator==(const Pixel& other) const { return r == other.r && g == other.g && b == other.b && a == other.a; }
+};
+
+int hashOf(const Pixel& p) {
+    return (p.r * 3 + p.g * 5 + p.b * 7 + p.a * 11) % 64;
+}
+
+uint32_t readBigEndian(const uint8_t* p) {
+    return static_cast<uint32_t>(p[0]) << 24 | static_cast<uint32_t>(p[1]) << 16 | static_cast<uint32_t>(p[2]) << 8 | p[3];
+}
+
+uint8_t* writeBigEndian(uint8_t* p, uint32_t value) {
+    *p++ = value >> 24;
+    *p++ = value >> 16;
+    *p++ = value >> 8;
+    *p++ = value;
+    return p;
+}
+
+} // namespace
+
+bool QoiCodec::decode(const uint8_t* data, size_t size, Image& image) {
+    if (size < HEADER_SIZE + sizeof(END_MARKER) || std::memcmp(data, "qoif", 4) != 0) return false;
+    const uint32_t width = readBigEndian(data + 4);
+    const uint32_t height = readBigEndian(data + 8);
+    const uint8_t channels = data[12];
+    if (width == 0 || height == 0 || width > 0x7fffffffu || height > 0x7fffffffu || (channels != 3 && channels != 4))
+        return false;
+    // Checked before anything is allocated: no byte of data covers more than a full run
+    const uint64_t pixels = static_cast<uint64_t>(width) * height;
+    if (pixels > MAX_PIXELS || pixels > MAX_RUN * (size - HEADER_SIZE - sizeof(END_MARKER))) return false;
+
+    Image decoded(static_cast<int>(width), static_cast<int>(height));
+    Pixel index[64] = {};
+    Pixel px = {0, 0, 0, 255};
+    int run = 0;
+    const uint8_t* p = data + HEADER_SIZE;
+    const uint8_t* end = data + size - sizeof(END_MARKER);
+    for (uint32_t y = 0; y < height; ++y) {
+        uint8_t* out = decoded.row(static_cast<int>(y));
+        for (uint32_t x = 0; x < width; ++x, out += 3) {
+            if (run > 0) {
+                --run;
+            } else {
+                // A truncated stream fails instead of reading past the end
+                if (p >= end) return false;
+                const uint8_t op = *p++;
+                if (op == OP_RGB) {
+                    if (end - p < 3) return false;
+                    px.r = p[0];
+                    px.g = p[1];
+                    px.b = p[2];
+                    p += 3;
+                } else if (op == OP_RGBA) {
+                    if (end - p < 4) return false;
+                    px = {p[0], p[1], p[2], p[3]};
+                    p += 4;
+                } else if ((op & TAG_MASK) == OP_INDEX) {
+                    px = index[op];
+                } else if ((op & TAG_MASK) == OP_DIFF) {
+                    px.r += ((op >> 4) & 3) - 2;
+                    px.g += ((op >> 2) & 3) - 2;
+                    px.b += (op & 3) - 2;
+                } else if ((op & TAG_MASK) == OP_LUMA) {
+                    if (p >= end) return false;
+                    const int dg = (op & 0x3f) - 32;
+                    const uint8_t next = *p++;
+                    px.r += dg - 8 + ((next >> 4) & 0x0f);
+                    px.g += dg;
+                    px.b += dg - 8 + (next & 0x0f);
+                } else {
+                    run = op & 0x3f;
+                }
+                index[hashOf(px)] = px;
+            }
+            out[0] = px.r;
+            out[1] = px.g;
+            out[2] = px.b;
+        }
+    }
+    image = std::move(decoded);
+    return true;
+}
+
+std::vector<uint8_t> QoiCodec::encode(const Image& image) {
+    const int width = image.getWidth();
+    const int height = image.getHeight();
+    std::vector<uint8_t> bytes(HEADER_SIZE + sizeof(END_MARKER));
+    uint8_t* p = bytes.data();
+    std::memcpy(p, "qoif", 4);
+    p = writeBigEndian(p + 4, width);
+    p = writeBigEndian(p, height);
+    *p++ = 3; // channels
+    *p++ = 0; // sRGB with linear alpha
+
+    Pixel index[64] = {};
+    Pixel prev = {0, 0, 0, 255};
+    int run = 0;
+    for (int y = 0; y < height; ++y) {
+        // A row takes at most an RGB op (four bytes) per pixel plus the run carried
+        // into it; the buffer grows geometrically, so it is touched only as far as used
+        const size_t used = p - bytes.data();
+        const size_t needed = used + 4 * static_cast<size_t>(width) + 1 + sizeof(END_MARKER);
+        if (needed > bytes.size()) bytes.resize(std::max(needed, 2 * bytes.size()));
+        p = bytes.data() + used;
+
+        const uint8_t* in = image.row(y);
+        for (int x = 0; x < width; ++x, in += 3) {
+            const Pixel px = {in[0], in[1], in[2], 255};
+            if (px == prev) {
+                if (++run == MAX_RUN) {
+                    *p++ = OP_RUN | (run - 1);
+                    run = 0;
+                }
+                continue;
+            }
+            if (run > 0) {
+                *p++ = OP_RUN | (run - 1);
+                run = 0;
+            }
+
+            const int slot = hashOf(px);
+            if (index[slot] == px) {
+                *p++ = OP_INDEX | slot;
+            } else {
+                index[slot] = px;
+                // Differences wrap around, as the decoder's byte arithmetic does
+                const int dr = static_cast<int8_t>(px.r - prev.r);
+                const int dg = static_cast<int8_t>(px.g - prev.g);
+                const int db = static_cast<int8_t>(px.b - prev.b);
+                const int drg = dr - dg;
+                const int dbg = db - dg;
+                if (dr >= -2 && dr <= 1 && dg >= -2 && dg <= 1 && db >= -2 && db <= 1) {
+                    *p++ = OP_DIFF | (dr + 2) << 4 | (dg + 2) << 2 | (db + 2);
+                } else if (dg >= -32 && dg <= 31 && drg >= -8 && drg <= 7 && dbg >= -8 && dbg <= 7) {
+                    *p++ = OP_LUMA | (dg + 32);
+                    *p++ = (drg + 8) << 4 | (dbg + 8);
+                } else {
+                    *p++ = OP_RGB;
+                    *p++ = px.r;
+                    *p++ = px.g;
+                    *p++ = px.b;
+                }
+            }
+            prev = px;
+        }
+    }
+    if (run > 0) *p++ = OP_RUN | (run - 1);
+
+    std::memcpy(p, END_MARKER, sizeof(END_MARKER));
+    bytes.resize(p + sizeof(END_MARKER) - bytes.data());
+    return bytes;
+}
@@ -0,0 +1,91 @@
+#include "QuadGrid.hpp"
+#include <algorithm>
+
+static std::vector<int> splitBoundaries(const std::vector<int>& bounds) {
+    std::vector<int> result;
+    result.reserve(bounds.size() * 2 - 1);
+    for (size_t i = 0; i + 1 < bounds.size(); ++i) {
+        result.push_back(bounds[i]);
+        result.push_back(bounds[i] + (bounds[i + 1] - bounds[i]) / 2);
+    }
+    result.push_back(bounds.back());
+    return result;
+}
+
+static int minSpan(const std::vector<int>& bounds) {
+    int span = bounds.back();
+    for (size_t i = 0; i + 1 < bounds.size(); ++i)
+        span = std::min(span, bounds[i + 1] - bounds[i]);
+    return span;
+}
+
+static int maxSpan(const std::vector<int>& bounds) {
+    int span = 0;
+    for (size_t i = 0; i + 1 < bounds.size(); ++i)
+        span = std::max(span, bounds[i + 1] - bounds[i]);
+    return span;
+}
+
+static std::vector<int> cellOf(const std::vector<int>& bounds) {
+    std::vector<int> result(bounds.back());
+    for (size_t c = 0; c + 1 < bounds.size(); ++c)
+        std::fill(result.begin() + bounds[c], result.begin() + bounds[c + 1], static_cast<int>(c));
+    return result;
+}
+
+QuadGrid::QuadGrid() : imageWidth(0), imageHeight(0) {}
+
+void QuadGrid::build(int width, int height, int64_t minCellArea, int maxLevels) {
+    imageWidth = width;
+    imageHeight = height;
+    xs.clear();
+    ys.clear();
+    if (width <= 0 || height <= 0) return;
+
+    xs.push_back({0, width});
+    ys.push_back({0, height});
+    while (levels() < maxLevels) {
+        std::vector<int> nextXs = splitBoundaries(xs.back());
+        std::vector<int> nextYs = splitBoundaries(ys.back());
+        if (static_cast<int64_t>(minSpan(nextXs)) * minSpan(nextYs) < minCellArea) break;
+        xs.push_back(std::move(nextXs));
+        ys.push_back(std::move(nextYs));
+    }
+}
+
+void QuadGrid::truncate(int levelCount) {
+    if (levelCount < levels()) {
+        xs.resize(levelCount);
+        ys.resize(levelCount);
+    }
+}
+
+int64_t QuadGrid::maxCellArea(int level) const {
+    return static_cast<int64_t>(maxSpan(xs[level])) * maxSpan(ys[level]);
+}
+
+bool QuadGrid::locate(int x, int y, int width, int height, int& level, size_t& cell) const {
+    for (int d = 0; d < levels(); ++d) {
+        // Cell spans at level d are the floor or ceil of the image size / 2^d
+        if (width < (imageWidth >> d) || width > ((imageWidth + (1 << d) - 1) >> d)) continue;
+        if (height < (imageHeight >> d) || height > ((imageHeight + (1 << d) - 1) >> d)) continue;
+
+        auto col = std::lower_bound(xs[d].begin(), xs[d].end(), x);
+        auto row = std::lower_bound(ys[d].begin(), ys[d].end(), y);
+        if (col + 1 >= xs[d].end() || *col != x || *(col + 1) != x + width) continue;
+        if (row + 1 >= ys[d].end() || *row != y || *(row + 1) != y + height) continue;
+
+        level = d;
+        cell = static_cast<size_t>(row - ys[d].begin()) * (xs[d].size() - 1) + (col - xs[d].begin());
+        return true;
+    }
+    return false;
+}
+
+std::vector<int> QuadGrid::finestColumnOf() const {
+    return cellOf(xs.back());
+}
+
+std::vector<int> QuadGrid::finestRowOf() const {
+    return cellOf(ys.back());
+}
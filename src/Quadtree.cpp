@@ -5,90 +5,52 @@ QuadtreeNode::QuadtreeNode(int x, int y, int width, int height)
     : x(x), y(y), width(width), height(height), depth(0),
       color(0, 0, 0), is_leaf(false), error(0.0) {
     for (int i = 0; i < 4; ++i)
-        children[i] = nullptr;
+        children[i] = NONE;
 }
 
-QuadtreeNode::~QuadtreeNode() {
-    for (int i = 0; i < 4; ++i) {
-        delete children[i];
-        children[i] = nullptr;
-    }
-}
-
-Quadtree::Quadtree(QuadtreeNode* root, int width, int height)
-    : root(root), width(width), height(height) {}
-
-Quadtree::~Quadtree() {
-    delete root;
-}
-
-static void fillBlock(std::vector<std::vector<Color>>& pixels, QuadtreeNode* node) {
-    if (!node) return;
+Quadtree::Quadtree(std::vector<QuadtreeNode>&& nodes, int width, int height)
+    : nodes(std::move(nodes)), width(width), height(height) {}
 
-    if (node->is_leaf) {
-        for (int i = node->y; i < node->y + node->height; ++i)
-            for (int j = node->x; j < node->x + node->width; ++j)
-                pixels[i][j] = node->color;
-    } else {
-        for (int i = 0; i < 4; ++i)
-            fillBlock(pixels, node->children[i]);
-    }
-}
-
-std::vector<std::vector<Color>> Quadtree::renderToPixels() const {
-    std::vector<std::vector<Color>> result(height, std::vector<Color>(width));
-    fillBlock(result, root);
+// Leaves tile the image, so painting them in array order needs no recursion
+Image Quadtree::renderToPixels() const {
+    Image result(width, height);
+    for (const QuadtreeNode& node : nodes)
+        if (node.is_leaf)
+            result.fill(node.x, node.y, node.width, node.height, node.color);
     return result;
 }
 
-static void drawWithDepth(QuadtreeNode* node, int targetDepth, std::vector<std::vector<Color>>& canvas) {
-    if (!node) return;
-
-    if (node->depth == targetDepth || node->is_leaf) {
-        for (int i = node->y; i < node->y + node->height; ++i)
-            for (int j = node->x; j < node->x + node->width; ++j)
-                canvas[i][j] = node->color;
-    } else {
-        for (int i = 0; i < 4; ++i)
-            drawWithDepth(node->children[i], targetDepth, canvas);
-    }
-}
-
-std::vector<std::vector<Color>> Quadtree::renderAtDepth(int depthLevel) const {
-    std::vector<std::vector<Color>> result(height, std::vector<Color>(width, Color(200, 200, 200)));;
-    drawWithDepth(root, depthLevel, result);
+// The blocks drawn at a depth are the nodes at that depth plus the shallower
+// leaves, which again tile the image
+Image Quadtree::renderAtDepth(int depthLevel) const {
+    Image result(width, height, Color(200, 200, 200));
+    for (const QuadtreeNode& node : nodes)
+        if (node.depth == depthLevel || (node.is_leaf && node.depth < depthLevel))
+            result.fill(node.x, node.y, node.width, node.height, node.color);
     return result;
 }
 
-int Quadtree::countNodes(const QuadtreeNode* node) const {
-    if (!node) return 0;
-    if (node->is_leaf) return 1;
-
-    int total = 1;
-    for (int i = 0; i < 4; ++i)
-        total += countNodes(node->children[i]);
-    return total;
+size_t Quadtree::countNodes() const {
+    return nodes.size();
 }
 
-int Quadtree::maxDepth(const QuadtreeNode* node) const {
-    if (!node || node->is_leaf) return 1;
-
+int Quadtree::maxDepth() const {
     int depth = 0;
-    for (int i = 0; i < 4; ++i)
-        depth = std::max(depth, maxDepth(node->children[i]));
-    return depth + 1;
+    for (const QuadtreeNode& node : nodes)
+        depth = std::max(depth, node.depth);
+    return nodes.empty() ? 0 : depth + 1;
 }
 
-int Quadtree::countNodes() const {
-    return countNodes(root);
+const QuadtreeNode& Quadtree::getRoot() const {
+    return nodes.front();
 }
 
-int Quadtree::maxDepth() const {
-    return maxDepth(root);
+const QuadtreeNode& Quadtree::child(const QuadtreeNode& node, int i) const {
+    return nodes[node.children[i]];
 }
 
-QuadtreeNode* Quadtree::getRoot() const {
-    return root;
+const std::vector<QuadtreeNode>& Quadtree::getNodes() const {
+    return nodes;
 }
 
 int Quadtree::getWidth() const {
@@ -97,4 +59,4 @@ int Quadtree::getWidth() const {
 
 int Quadtree::getHeight() const {
     return height;
-}
\ No newline at end of file
+}
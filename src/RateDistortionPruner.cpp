@@ -0,0 +1,122 @@
+#include "RateDistortionPruner.hpp"
+#include <algorithm>
+#include <limits>
+#include <queue>
+
+// Bits for a subtree of the given node count: a quadtree with n nodes has (3n + 1) / 4 leaves
+static uint64_t subtreeBits(uint64_t nodes) {
+    return nodes + 24 * ((3 * nodes + 1) / 4);
+}
+
+RateDistortionPruner::RateDistortionPruner(const ErrorTree& tree)
+    : tree(tree), collapseAt(tree.getFull().getNodes().size(), std::numeric_limits<double>::infinity()) {
+    const std::vector<QuadtreeNode>& nodes = tree.getFull().getNodes();
+    const std::vector<uint64_t>& squaredError = tree.getSquaredError();
+    const uint32_t count = nodes.size();
+    if (count == 0) return;
+
+    // Distortion and size of every subtree as it currently stands. Children follow
+    // their parent in preorder, so a reverse scan sees them first.
+    std::vector<uint32_t> parent(count, QuadtreeNode::NONE);
+    std::vector<int64_t> subError(count);
+    std::vector<uint32_t> subNodes(count);
+    for (uint32_t i = count; i-- > 0;) {
+        const QuadtreeNode& node = nodes[i];
+        if (node.is_leaf) {
+            subError[i] = squaredError[i];
+            subNodes[i] = 1;
+            continue;
+        }
+        subError[i] = 0;
+        subNodes[i] = 1;
+        for (uint32_t child : node.children) {
+            parent[child] = i;
+            subError[i] += subError[child];
+            subNodes[i] += subNodes[child];
+        }
+    }
+
+    // The weakest link is the inner node whose collapse adds the least error per
+    // bit saved. A collapse only raises its ancestors' slopes (the ancestor's slope
+    // averages the collapsed one, which was the lowest, with its new slope), so an
+    // entry is a lower bound: it is re-keyed when popped rather than on every change.
+    struct Link {
+        double slope;
+        uint32_t index;
+        bool operator<(const Link& other) const { return slope > other.slope; }
+    };
+    std::vector<char> removed(count, 0);
+    auto link = [&](uint32_t i) {
+        double saved = static_cast<double>(subtreeBits(subNodes[i]) - subtreeBits(1));
+        return Link{(static_cast<int64_t>(squaredError[i]) - subError[i]) / saved, i};
+    };
+
+    std::vector<Link> initial;
+    for (uint32_t i = 0; i < count; ++i)
+        if (!nodes[i].is_leaf) initial.push_back(link(i));
+    std::priority_queue<Link> links(std::less<Link>(), std::move(initial));
+
+    RatePoint current{-std::numeric_limits<double>::infinity(), subNodes[0], (3 * size_t(subNodes[0]) + 1) / 4,
+                      subtreeBits(subNodes[0]), static_cast<uint64_t>(subError[0])};
+    points.push_back(current);
+
+    std::vector<uint32_t> pending;
+    double lambda = -std::numeric_limits<double>::infinity();
+    while (!links.empty()) {
+        Link weakest = links.top();
+        links.pop();
+        const uint32_t i = weakest.index;
+        if (removed[i]) continue;
+        Link fresh = link(i);
+        if (fresh.slope > weakest.slope) {
+            links.push(fresh);
+            continue;
+        }
+
+        // Slopes only rise as links are cut, the max guards against rounding
+        lambda = std::max(lambda, weakest.slope);
+        collapseAt[i] = lambda;
+        removed[i] = 1;
+
+        const int64_t addedError = static_cast<int64_t>(squaredError[i]) - subError[i];
+        const uint32_t droppedNodes = subNodes[i] - 1;
+        for (uint32_t a = parent[i]; a != QuadtreeNode::NONE; a = parent[a]) {
+            subError[a] += addedError;
+            subNodes[a] -= droppedNodes;
+        }
+
+        // Everything below is gone with it; nodes already removed took their subtrees along
+        pending.assign(nodes[i].children, nodes[i].children + 4);
+        while (!pending.empty()) {
+            uint32_t c = pending.back();
+            pending.pop_back();
+            if (nodes[c].is_leaf || removed[c]) continue;
+            removed[c] = 1;
+            pending.insert(pending.end(), nodes[c].children, nodes[c].children + 4);
+        }
+
+        // A cut at lambda takes every collapse tied with it, so ties make one point
+        current.lambda = lambda;
+        current.nodes -= droppedNodes;
+        current.leaves = (3 * current.nodes + 1) / 4;
+        current.bits = subtreeBits(current.nodes);
+        current.squaredError += addedError;
+        if (points.back().lambda == lambda) points.back() = current;
+        else points.push_back(current);
+    }
+}
+
+Quadtree* RateDistortionPruner::prune(double lambda) const {
+    return tree.cut(collapseAt, lambda);
+}
+
+const RatePoint& RateDistortionPruner::pointForBytes(double bytes) const {
+    // Bits fall along the curve, so the first point that fits has the least error
+    auto fits = std::partition_point(points.begin(), points.end(),
+                                     [&](const RatePoint& p) { return p.bits / 8.0 > bytes; });
+    return fits == points.end() ? points.back() : *fits;
+}
+
+Quadtree* RateDistortionPruner::pruneToBytes(double bytes) const {
+    return prune(pointForBytes(bytes).lambda);
+}
@@ -0,0 +1,56 @@
+#include "RunStats.hpp"
+#include <string>
+
+RunStats::RunStats()
+    : nodesEvaluated(0), evaluatedArea(0), encoderCalls(0), bytesEncoded(0), bytesWritten(0) {
+    for (std::atomic<int64_t>& phase : nanoseconds) phase = 0;
+}
+
+void RunStats::addTime(Phase phase, Clock::duration elapsed) {
+    nanoseconds[phase] += std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count();
+}
+
+void RunStats::addEvaluations(const Quadtree& tree) {
+    uint64_t area = 0;
+    for (const QuadtreeNode& node : tree.getNodes())
+        area += static_cast<uint64_t>(node.width) * node.height;
+    addEvaluations(tree.getNodes().size(), area);
+}
+
+void RunStats::addEvaluations(uint64_t nodes, uint64_t area) {
+    nodesEvaluated += nodes;
+    evaluatedArea += area;
+}
+
+const char* RunStats::name(Phase phase) {
+    static const char* const names[PHASES] = {"decode", "prepare", "build", "render", "encode", "gif_palette", "gif_lzw",
+                                              "score"};
+    return names[phase];
+}
+
+void RunStats::print(std::ostream& out, double totalMs) const {
+    static const char* const labels[PHASES] = {"Decode", "Tables", "Tree build", "Render", "Encode",
+                                               "GIF palette", "GIF LZW", "Report scoring"};
+    const char* prefix = "\033[1;36m[OUTPUT]\033[0m   ";
+    double phases = 0.0;
+    for (int p = 0; p < PHASES; ++p) {
+        if (p != SCORE) phases += milliseconds(static_cast<Phase>(p));
+        out << prefix << labels[p] << std::string(20 - std::string(labels[p]).size(), ' ') << ": "
+            << milliseconds(static_cast<Phase>(p)) << " ms\n";
+    }
+    // Negative when phases overlapped on the pool
+    if (phases <= totalMs)
+        out << prefix << "Other               : " << totalMs - phases << " ms\n";
+    out << prefix << "Nodes evaluated     : " << nodesEvaluated << " (" << evaluatedArea << " px of block area)\n";
+    out << prefix << "Encoder calls       : " << encoderCalls << " (" << bytesEncoded / 1024.0 << " KB out)\n";
+    out << prefix << "Bytes written       : " << bytesWritten << "\n";
+}
+
+void RunStats::writeJson(std::ostream& out, double totalMs) const {
+    out << "{\n  \"total_ms\": " << totalMs << ",\n  \"phases_ms\": {";
+    for (int p = 0; p < PHASES; ++p)
+        out << (p ? ", " : "") << "\"" << name(static_cast<Phase>(p)) << "\": " << milliseconds(static_cast<Phase>(p));
+    out << "},\n  \"nodes_evaluated\": " << nodesEvaluated << ",\n  \"evaluated_block_area\": " << evaluatedArea
+        << ",\n  \"encoder_calls\": " << encoderCalls << ",\n  \"bytes_encoded\": " << bytesEncoded
+        << ",\n  \"bytes_written\": " << bytesWritten << "\n}\n";
+}
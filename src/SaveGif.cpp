@@ -1,15 +1,16 @@
 #include "SaveGif.hpp"
+#include <filesystem>
 #include <iostream>
 #include "gif.h"
 
-bool SaveGif::saveGIF(const std::string &gifPath, const std::vector<std::vector<std::vector<Color>>> &frames, int delayMs) {
+bool SaveGif::saveGIF(const std::string &gifPath, const std::vector<Image> &frames, int delayMs, RunStats *stats) {
     if (frames.empty()) {
         std::cerr << "[ERROR] No frames provided to save GIF." << std::endl;
         return false;
     }
 
-    int height = frames[0].size();
-    int width = frames[0][0].size();
+    int height = frames[0].getHeight();
+    int width = frames[0].getWidth();
 
     GifWriter writer;
     if (!GifBegin(&writer, gifPath.c_str(), width, height, delayMs)) {
@@ -17,23 +18,34 @@ bool SaveGif::saveGIF(const std::string &gifPath, const std::vector<std::vector<
         return false;
     }
 
+    std::vector<uint8_t> frameData(static_cast<size_t>(width) * height * 4);
     for (const auto& frame : frames) {
-        std::vector<uint8_t> frameData(width * height * 4);
-
+        uint8_t* dst = frameData.data();
         for (int y = 0; y < height; ++y) {
-            for (int x = 0; x < width; ++x) {
-                int idx = (y * width + x) * 4;
-                frameData[idx + 0] = frame[y][x].r;
-                frameData[idx + 1] = frame[y][x].g;
-                frameData[idx + 2] = frame[y][x].b;
-                frameData[idx + 3] = 255;
+            const uint8_t* src = frame.row(y);
+            for (int x = 0; x < width; ++x, src += 3, dst += 4) {
+                dst[0] = src[0];
+                dst[1] = src[1];
+                dst[2] = src[2];
+                dst[3] = 255;
             }
         }
 
-        GifWriteFrame(&writer, frameData.data(), width, height, delayMs);
+        // GifWriteFrame without dithering, split so the two halves are timed apart
+        const uint8_t* previous = writer.firstFrame ? NULL : writer.oldImage;
+        writer.firstFrame = false;
+        GifPalette palette;
+        {
+            RunStats::Scope timer(stats, RunStats::GIF_PALETTE);
+            GifMakePalette(previous, frameData.data(), width, height, 8, false, &palette);
+            GifThresholdImage(previous, frameData.data(), writer.oldImage, width, height, &palette);
+        }
+        RunStats::Scope timer(stats, RunStats::GIF_LZW);
+        GifWriteLzwImage(writer.f, writer.oldImage, 0, 0, width, height, delayMs, &palette);
     }
 
     GifEnd(&writer);
+    if (stats) stats->addWritten(std::filesystem::file_size(gifPath));
     std::cout << "[INFO] GIF saved successfully to: " << gifPath << std::endl;
     return true;
 }
@@ -0,0 +1,64 @@
+#include "SizeEstimator.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+
+TreeStats SizeEstimator::stats(const std::vector<QuadtreeNode>& nodes, int rows) {
+    TreeStats s = {0, 0.0, rows, 0, {0.0, 0.0}};
+
+    // One bit per 24-bit colour, kept by the thread from call to call: the search
+    // estimates at every step, so only the words this call set are cleared again
+    thread_local std::vector<uint64_t> seen(size_t(1) << 18, 0);
+    thread_local std::vector<uint32_t> touched;
+    for (const QuadtreeNode& node : nodes) {
+        if (!node.is_leaf || node.width == 0) continue;
+        ++s.leaves;
+        s.topEdgePixels += node.width;
+        int side = std::min(node.width, node.height);
+        if (side <= 2) s.thinPixels[side - 1] += static_cast<double>(node.width) * node.height;
+
+        uint32_t colour = static_cast<uint32_t>(node.color.r) << 16 | node.color.g << 8 | node.color.b;
+        uint64_t bit = uint64_t(1) << (colour & 63);
+        uint64_t& word = seen[colour >> 6];
+        if (!(word & bit)) {
+            if (!word) touched.push_back(colour >> 6);
+            word |= bit;
+            ++s.colours;
+        }
+    }
+    for (uint32_t index : touched) seen[index] = 0;
+    touched.clear();
+    return s;
+}
+
+double SizeEstimator::model(const TreeStats& s) {
+    // Least squares on relative error over trees of all five metrics on every test
+    // image, thresholds over a 128x range and minimum blocks 1 and 4
+    return 1.342 * s.leaves + 0.214 * s.topEdgePixels + 18.86 * s.rows + 2.189 * s.colours +
+           0.066 * s.thinPixels[0] + 0.560 * s.thinPixels[1];
+}
+
+void SizeEstimator::calibrate(const Quadtree& tree, int64_t encodedSize) {
+    double modelled = model(stats(tree));
+    if (encodedSize <= 0 || modelled <= 0) return;
+    Sample sample = {modelled, encodedSize / modelled};
+    auto at = std::lower_bound(samples.begin(), samples.end(), sample,
+                               [](const Sample& a, const Sample& b) { return a.modelled < b.modelled; });
+    samples.insert(at, sample);
+}
+
+double SizeEstimator::predict(const TreeStats& stats) const {
+    double modelled = model(stats);
+    if (samples.empty()) return modelled;
+
+    auto above = std::lower_bound(samples.begin(), samples.end(), modelled,
+                                  [](const Sample& a, double m) { return a.modelled < m; });
+    if (above == samples.begin()) return modelled * above->scale;
+    if (above == samples.end()) return modelled * samples.back().scale;
+
+    // Between two samples the scale is interpolated on a log scale of size
+    auto below = above - 1;
+    double span = std::log(above->modelled) - std::log(below->modelled);
+    double t = span > 0 ? (std::log(modelled) - std::log(below->modelled)) / span : 0.0;
+    return modelled * (below->scale + t * (above->scale - below->scale));
+}
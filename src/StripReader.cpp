@@ -0,0 +1,53 @@
+#include "StripReader.hpp"
+#include <cstring>
+
+StripReader::StripReader() : width(0), height(0), stats(nullptr) {}
+
+bool StripReader::openRaw(const std::string& path) {
+    if (!ImageIO::rawLayout(path, layout)) return false;
+    file.open(path, std::ios::binary);
+    width = static_cast<int>(layout.width);
+    height = static_cast<int>(layout.height);
+    return static_cast<bool>(file);
+}
+
+bool StripReader::open(const std::string& path, RunStats* stats) {
+    this->stats = stats;
+    {
+        RunStats::Scope timer(stats, RunStats::DECODE);
+        if (openRaw(path)) return true;
+    }
+    file.close();
+    if (!ImageIO::loadImage(path, loaded, stats)) return false;
+    width = loaded.getWidth();
+    height = loaded.getHeight();
+    return true;
+}
+
+bool StripReader::read(int y, int rows, Image& band) {
+    RunStats::Scope timer(stats, RunStats::DECODE);
+    if (y < 0 || rows <= 0 || y + rows > height) return false;
+    if (band.getWidth() != width || band.getHeight() != rows) band = Image(width, rows);
+
+    const size_t rowBytes = 3 * static_cast<size_t>(width);
+    if (!streams()) {
+        for (int i = 0; i < rows; ++i)
+            std::memcpy(band.row(i), loaded.row(y + i), rowBytes);
+        return true;
+    }
+
+    file.clear();
+    file.seekg(layout.offset + static_cast<int64_t>(y) * layout.stride);
+    // Packed RGB rows are laid out as the band's own, so the whole band is one read
+    if (layout.depth == 3 && layout.stride == static_cast<int64_t>(rowBytes))
+        return static_cast<bool>(file.read(reinterpret_cast<char*>(band.row(0)), rowBytes * rows));
+
+    // Otherwise row by row, past any padding, converted on the way in
+    fileRow.resize(static_cast<size_t>(layout.depth * layout.width));
+    for (int i = 0; i < rows; ++i) {
+        if (i > 0) file.seekg(layout.offset + static_cast<int64_t>(y + i) * layout.stride);
+        if (!file.read(reinterpret_cast<char*>(fileRow.data()), fileRow.size())) return false;
+        layout.toRgb(fileRow.data(), band.row(i));
+    }
+    return true;
+}
@@ -0,0 +1,103 @@
+#include "ThreadPool.hpp"
+#include <algorithm>
+
+// Index of the calling thread's queue in the pool it works for
+static thread_local const ThreadPool* currentPool = nullptr;
+static thread_local int currentSlot = 0;
+
+ThreadPool::ThreadPool(int threads) : queued(0), stopping(false) {
+    if (threads <= 0) threads = std::max(1u, std::thread::hardware_concurrency());
+    for (int i = 0; i < threads; ++i)
+        queues.push_back(std::make_unique<Queue>());
+    for (int i = 1; i < threads; ++i)
+        workers.emplace_back(&ThreadPool::workerLoop, this, i);
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(sleepMutex);
+        stopping = true;
+    }
+    wake.notify_all();
+    for (auto& worker : workers)
+        worker.join();
+}
+
+int ThreadPool::currentIndex() const {
+    return currentPool == this ? currentSlot : 0;
+}
+
+void ThreadPool::spawn(TaskGroup& group, std::function<void()> task) {
+    group.pending.fetch_add(1);
+    Queue& queue = *queues[currentIndex()];
+    {
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        queue.tasks.push_back([&group, task = std::move(task)] {
+            task();
+            group.pending.fetch_sub(1);
+        });
+    }
+    queued.fetch_add(1);
+
+    // Taking the lock orders this push before a worker's check-then-sleep
+    { std::lock_guard<std::mutex> lock(sleepMutex); }
+    wake.notify_one();
+}
+
+void ThreadPool::wait(TaskGroup& group) {
+    int self = currentIndex();
+    while (group.pending.load() > 0)
+        if (!tryRunOne(self))
+            std::this_thread::yield();
+}
+
+void ThreadPool::parallelFor(int begin, int end, const std::function<void(int, int)>& body) {
+    int count = end - begin;
+    int chunks = std::max(1, std::min(size(), count));
+    int chunk = (count + chunks - 1) / chunks;
+
+    TaskGroup group;
+    for (int start = begin + chunk; start < end; start += chunk)
+        spawn(group, [&body, start, end, chunk] { body(start, std::min(end, start + chunk)); });
+    body(begin, std::min(end, begin + chunk));
+    wait(group);
+}
+
+bool ThreadPool::tryRunOne(int self) {
+    std::function<void()> task;
+
+    // Own queue first, newest task (depth-first), then the oldest task of another queue
+    {
+        Queue& own = *queues[self];
+        std::lock_guard<std::mutex> lock(own.mutex);
+        if (!own.tasks.empty()) {
+            task = std::move(own.tasks.back());
+            own.tasks.pop_back();
+        }
+    }
+    for (int i = 1; !task && i < size(); ++i) {
+        Queue& victim = *queues[(self + i) % size()];
+        std::lock_guard<std::mutex> lock(victim.mutex);
+        if (!victim.tasks.empty()) {
+            task = std::move(victim.tasks.front());
+            victim.tasks.pop_front();
+        }
+    }
+
+    if (!task) return false;
+    queued.fetch_sub(1);
+    task();
+    return true;
+}
+
+void ThreadPool::workerLoop(int self) {
+    currentPool = this;
+    currentSlot = self;
+    while (true) {
+        if (tryRunOne(self)) continue;
+
+        std::unique_lock<std::mutex> lock(sleepMutex);
+        wake.wait(lock, [this] { return stopping || queued.load() > 0; });
+        if (stopping && queued.load() == 0) return;
+    }
+}
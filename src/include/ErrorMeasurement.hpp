@@ -1,18 +1,74 @@
 #ifndef __ERRORMEASUREMENT_HPP__
 #define __ERRORMEASUREMENT_HPP__
 
+#include <functional>
 #include <vector>
 #include "Colors.hpp"
+#include "Image.hpp"
+#include "IntegralImage.hpp"
+#include "HistogramPyramid.hpp"
+#include "MinMaxPyramid.hpp"
+
+// The image plus whichever precomputed tables were built for it. Null tables
+// (or tables built for another image) make the metrics scan the pixels instead.
+struct MetricSource {
+    const Image* pixels = nullptr;
+    const IntegralImage* integral = nullptr;
+    const HistogramPyramid* histograms = nullptr;
+    const MinMaxPyramid* ranges = nullptr;
+};
+
+// Everything build needs from one look at a block: its error, its mean colour
+// (the leaf colour) and, when they come for free, the per-channel moments.
+struct NodeEvaluation {
+    double error;
+    Color mean;
+    bool hasMoments;
+    BlockMoments moments;
+};
 
 class ErrorMeasurement {
 public:
     static const int MAX_COLOR = 256;
-    
-    static double variance(const std::vector<std::vector<Color>>& pixels, int x, int y, int width, int height);
-    static double mad(const std::vector<std::vector<Color>>& pixels, int x, int y, int width, int height);
-    static double maxPixelDifference(const std::vector<std::vector<Color>>& pixels, int x, int y, int width, int height);
-    static double entropy(const std::vector<std::vector<Color>>& pixels, int x, int y, int width, int height);
-    static double ssim(const std::vector<std::vector<Color>>& pixels, int x, int y, int width, int height);
+    static const int SMALL_BLOCK_AREA = 256; // below this, histogram metrics work on the pixels directly
+
+    static NodeEvaluation variance(const MetricSource& source, int x, int y, int width, int height);
+    static NodeEvaluation mad(const MetricSource& source, int x, int y, int width, int height);
+    static NodeEvaluation maxPixelDifference(const MetricSource& source, int x, int y, int width, int height);
+    static NodeEvaluation entropy(const MetricSource& source, int x, int y, int width, int height);
+    static NodeEvaluation ssim(const MetricSource& source, int x, int y, int width, int height);
+
+    // Per-channel sums of a block, from the integral tables when there are any
+    static BlockMoments moments(const MetricSource& source, int x, int y, int width, int height);
+    // Summed squared error of a block drawn flat in colour c, exact from its moments
+    static uint64_t squaredError(const BlockMoments& m, const Color& c);
+    // SSIM of a block against a flat block of colour c, luminance-weighted over channels
+    static double flatSsim(const BlockMoments& m, const Color& c);
+    // dB for a squared error summed over samples 8-bit values, infinite when there is none
+    static double psnr(double squaredError, double samples);
+};
+
+// Metric types for QuadtreeBuilder, one per ErrorMeasurement function
+struct VarianceMetric {
+    NodeEvaluation operator()(const MetricSource& s, int x, int y, int w, int h) const { return ErrorMeasurement::variance(s, x, y, w, h); }
+};
+struct MadMetric {
+    NodeEvaluation operator()(const MetricSource& s, int x, int y, int w, int h) const { return ErrorMeasurement::mad(s, x, y, w, h); }
+};
+struct MaxDifferenceMetric {
+    NodeEvaluation operator()(const MetricSource& s, int x, int y, int w, int h) const { return ErrorMeasurement::maxPixelDifference(s, x, y, w, h); }
+};
+struct EntropyMetric {
+    NodeEvaluation operator()(const MetricSource& s, int x, int y, int w, int h) const { return ErrorMeasurement::entropy(s, x, y, w, h); }
+};
+struct SsimMetric {
+    NodeEvaluation operator()(const MetricSource& s, int x, int y, int w, int h) const { return ErrorMeasurement::ssim(s, x, y, w, h); }
+};
+
+// Any callable chosen at runtime, at the cost of an indirect call per node
+struct DynamicMetric {
+    std::function<NodeEvaluation(const MetricSource&, int, int, int, int)> func;
+    NodeEvaluation operator()(const MetricSource& s, int x, int y, int w, int h) const { return func(s, x, y, w, h); }
 };
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,56 @@
+#ifndef ERROR_TREE_HPP
+#define ERROR_TREE_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+#include "Image.hpp"
+#include "IntegralImage.hpp"
+#include "Quadtree.hpp"
+
+// One threshold of a sweep
+struct SweepPoint {
+    double threshold;
+    size_t nodes;
+    size_t leaves;
+    double estimatedBytes; // the tree stored as one split bit per node plus a 24-bit colour per leaf
+    double psnr;           // rendered image against the original, in dB
+    double ssim;           // mean over pixels of each leaf's SSIM against its flat colour
+};
+
+// A quadtree built once down to the minimum block size, every node keeping its
+// error and mean colour. The tree for any threshold is a cut of it: a node is a
+// leaf where the full tree stops or where its error is within the threshold,
+// which is the same rule QuadtreeBuilder applies while building.
+class ErrorTree {
+public:
+    // full must be built with no threshold, i.e. every allowed split taken
+    ErrorTree(Quadtree* full, const Image& pixels);
+
+    const Quadtree& getFull() const { return *full; }
+    const std::vector<uint64_t>& getSquaredError() const { return squaredError; }
+    uint64_t getSamples() const { return samples; }
+
+    // O(nodes of the result)
+    Quadtree* cut(double threshold) const;
+    // The same with any per-node key in place of the node's error: a node is a
+    // leaf where keys[index] <= limit
+    Quadtree* cut(const std::vector<double>& keys, double limit) const;
+
+    // Node count, leaf count, size estimate, PSNR and SSIM for every threshold, from a
+    // single traversal of the nodes visible at the smallest one
+    std::vector<SweepPoint> sweep(const std::vector<double>& thresholds) const;
+
+private:
+    std::unique_ptr<Quadtree> full;
+    std::vector<uint64_t> squaredError; // per node, of its block against its mean colour
+    std::vector<double> similarity;     // per node, its block's flat SSIM times its area
+    uint64_t samples;                   // 3 * width * height
+
+    BlockMoments collect(uint32_t index, const Image& pixels);
+    // keys null means the nodes' own errors
+    uint32_t cut(uint32_t index, const double* keys, double limit, std::vector<QuadtreeNode>& out) const;
+};
+
+#endif
@@ -0,0 +1,40 @@
+#ifndef HISTOGRAM_PYRAMID_HPP
+#define HISTOGRAM_PYRAMID_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "Image.hpp"
+#include "QuadGrid.hpp"
+
+// Per-channel histograms for every block of the quadtree split grid, down to a
+// level whose cells are still large enough to be worth storing. The finest level
+// is filled from the pixels once, every coarser cell is the merge of its four children.
+class HistogramPyramid {
+public:
+    static const int BINS = 256;
+
+    HistogramPyramid();
+
+    void build(const Image& pixels);
+    bool matches(int width, int height) const;
+
+    // Copies the histogram of a quadtree block into hist. Returns false when the
+    // block is not on the stored grid (finer than the deepest level).
+    bool histogram(int x, int y, int width, int height, uint32_t hist[3][BINS]) const;
+
+private:
+    struct Level {
+        bool narrow; // counts fit in 16 bits
+        std::vector<uint16_t> narrowBins;
+        std::vector<uint32_t> wideBins;
+    };
+
+    QuadGrid grid;
+    std::vector<Level> levels;
+
+    static const int64_t MIN_CELL_AREA = 1024;
+    static const size_t MAX_BYTES = 256u << 20;
+};
+
+#endif
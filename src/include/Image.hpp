@@ -0,0 +1,60 @@
+#ifndef IMAGE_HPP
+#define IMAGE_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include "Colors.hpp"
+
+// Packed 8-bit RGB pixels in one buffer. Rows are `stride` bytes apart (at
+// least 3 * width), so any row is a plain run of interleaved r, g, b bytes.
+// The buffer is either allocated by the image or adopted from whoever filled
+// it (a decoder, a file mapping), in which case the image frees it with that
+// owner's release.
+class Image {
+public:
+    using Release = std::function<void(uint8_t* data)>;
+
+    Image();
+    Image(int width, int height, const Color& fill = Color());
+    // Takes ownership of data, already in this layout; release frees it
+    Image(uint8_t* data, int width, int height, size_t stride, Release release);
+
+    // Copies get a buffer of their own
+    Image(const Image& other);
+    Image& operator=(const Image& other);
+    Image(Image&&) noexcept = default;
+    Image& operator=(Image&&) noexcept = default;
+
+    int getWidth() const { return width; }
+    int getHeight() const { return height; }
+    size_t getStride() const { return stride; }
+    bool empty() const { return width == 0 || height == 0; }
+
+    uint8_t* row(int y) { return pixels.get() + static_cast<size_t>(y) * stride; }
+    const uint8_t* row(int y) const { return pixels.get() + static_cast<size_t>(y) * stride; }
+    const uint8_t* pixel(int x, int y) const { return row(y) + 3 * static_cast<size_t>(x); }
+
+    Color at(int x, int y) const {
+        const uint8_t* p = pixel(x, y);
+        return Color(p[0], p[1], p[2]);
+    }
+    void set(int x, int y, const Color& c) {
+        uint8_t* p = row(y) + 3 * static_cast<size_t>(x);
+        p[0] = c.r;
+        p[1] = c.g;
+        p[2] = c.b;
+    }
+    void fill(int x, int y, int width, int height, const Color& c);
+
+private:
+    int width;
+    int height;
+    size_t stride;
+    std::unique_ptr<uint8_t, Release> pixels;
+
+    static void releaseOwned(uint8_t* data) { delete[] data; }
+};
+
+#endif
@@ -1,34 +1,100 @@
 #ifndef IMAGE_COMPRESSOR_HPP
 #define IMAGE_COMPRESSOR_HPP
 
+#include <cstdint>
+#include <memory>
 #include <string>
 #include <vector>
-#include <functional>
-#include "Colors.hpp"
+#include "Image.hpp"
 #include "Quadtree.hpp"
 #include "ErrorMeasurement.hpp"
+#include "IntegralImage.hpp"
+#include "HistogramPyramid.hpp"
+#include "MinMaxPyramid.hpp"
+#include "ErrorTree.hpp"
+#include "ThreadPool.hpp"
+#include "RunStats.hpp"
+#include "StripReader.hpp"
+#include "ImageIO.hpp"
+
+// Settings taken from the command line rather than the prompts
+struct CompressorOptions {
+    int threads = 0;                // 0 = every hardware thread, 1 = serial build
+    int64_t parallelMinArea = 128 * 128; // smaller blocks are built serially
+    int parallelMaxDepth = 6;       // deeper blocks are built serially
+    double sizeTolerance = 0.005;   // target search stops within this ratio above the target
+    int maxSearchSteps = 10;        // bisection steps after the bracket ends, 10 narrows it 1024x
+    bool estimateSizes = true;      // --estimate off: encode every target-search candidate instead of estimating (PNG only)
+    int maxConfirmations = 4;       // real encodes after the bracket ends, when estimating
+    int searchWidth = 1;            // --search-width: thresholds tried at once per round, 0 = one per thread
+    std::vector<double> sweepThresholds; // --sweep: report these thresholds from a single build first
+    int64_t leafBudget = 0;         // --leaves: grow best-first to at most this many leaves, 0 = off
+    int64_t nodeBudget = 0;         // --nodes: the same in nodes; the smaller budget wins when both are set
+    bool budgetByArea = false;      // --priority area: split the largest error x area first
+    bool rateDistortion = false;    // --search rd: target mode walks the rate-distortion curve of the full tree
+    double lambda = -1;             // --lambda: prune the full tree for squared error + lambda * bits, < 0 = off
+    double targetPsnr = 0;          // --psnr: the smallest cut of the full tree with at least this PSNR in dB, 0 = off
+    double targetSsim = 0;          // --ssim: the same for the mean of the leaves' SSIM, 0 = off
+    std::string statsJson;          // --stats-json: also write the report's timings and counters here
+    int64_t tileBudget = 0;         // --tile-budget: build tile by tile in about this many MB, 0 = whole image
+    int jpegQuality = ImageIO::DEFAULT_JPEG_QUALITY; // --jpeg-quality: 1-100, for .jpg and .jpeg output
+};
 
 class ImageCompressor {
 public:
 
-    ImageCompressor();
+    explicit ImageCompressor(const CompressorOptions& options = CompressorOptions());
     void run();
     ~ImageCompressor() noexcept = default;  
 
 private:
     double threshold;
     int min_block_size;
-    std::function<double(const std::vector<std::vector<Color>>&, int, int, int, int)> errorFunc;
+    CompressorOptions options;
+    ImageCodec outputCodec;
+    std::unique_ptr<ThreadPool> pool;
+    std::unique_ptr<RunStats> runStats;
+    IntegralImage integral;
+    HistogramPyramid histograms;
+    MinMaxPyramid ranges;
 
-    Color getAverageColor(const std::vector<std::vector<Color>>& image_data, int x, int y, int width, int height);
-    bool shouldDivide(double error, int width, int height);
-    QuadtreeNode* build(const std::vector<std::vector<Color>>& image_data, int x, int y, int width, int heigh, int depth);
-    Quadtree* compress(const std::vector<std::vector<Color>>& image_data,
+    MetricSource metricSource(const Image& image_data) const;
+    // Size of a candidate written in the output's codec, encoded in memory
+    int64_t encodedSize(const Quadtree* tree) const;
+    // The flag of the mode that builds instead of the target search, or nullptr
+    const char* overridingMode() const;
+    // The tables the chosen metric reads, over image_data
+    void prepareTables(int methodChoice, const Image& image_data);
+    template <typename Metric>
+    Quadtree* buildTree(const Metric& metric, const Image& image_data, double threshold) const;
+    // fn() with its time counted under phase
+    template <typename Fn>
+    auto timed(RunStats::Phase phase, Fn fn) const {
+        RunStats::Scope timer(runStats.get(), phase);
+        return fn();
+    }
+    template <typename Metric>
+    ErrorTree buildErrorTree(const Metric& metric, const Image& image_data) const;
+    template <typename Metric>
+    Quadtree* compressConcurrently(const Metric& metric, const Image& image_data, double target_compression,
+                                   int64_t originalSize, int width) const;
+    template <typename Metric>
+    Quadtree* compressRateDistortion(const Metric& metric, const Image& image_data, double target_compression,
+                                     int64_t originalSize) const;
+    template <typename Metric>
+    Quadtree* compressToQuality(const Metric& metric, const Image& image_data) const;
+    template <typename Metric>
+    Quadtree* compressTiled(const Metric& metric, int methodChoice, StripReader& reader, uint64_t& squaredError);
+    template <typename Metric>
+    Quadtree* buildToBudget(const Metric& metric, const Image& image_data) const;
+    template <typename Metric>
+    void printSweep(const Metric& metric, const Image& image_data) const;
+    template <typename Metric>
+    Quadtree* compress(const Metric& metric,
+        const Image& image_data,
         double target_compression,
-        const std::string& tempPath,
-        long originalSize,
-        std::vector<std::vector<std::vector<Color>>>* gifFrames);
-    void setErrorFunction(std::function<double(const std::vector<std::vector<Color>>&, int, int, int, int)> func);
+        int64_t originalSize,
+        std::vector<Image>* gifFrames);
 };
 
 #endif
\ No newline at end of file
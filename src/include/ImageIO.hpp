@@ -1,16 +1,50 @@
 #ifndef IMAGE_IO_HPP
 #define IMAGE_IO_HPP
 
+#include <cstdint>
 #include <string>
 #include <vector>
-#include "Colors.hpp"
+#include "Image.hpp"
 #include "Quadtree.hpp"
+#include "RunStats.hpp"
+
+// What saveImage writes, picked by the extension of the output path
+enum class ImageCodec { PNG, JPEG, BMP, TGA, PPM, QOI };
+
+// Where the pixels of an uncompressed file are: `depth` 8-bit samples per pixel,
+// rows `stride` bytes apart from `offset` on
+struct RawLayout {
+    int64_t width = 0, height = 0, depth = 3, stride = 0, offset = 0;
+
+    // One row of the file as packed RGB: grey is repeated and alpha dropped
+    void toRgb(const uint8_t *row, uint8_t *rgb) const;
+};
 
 class ImageIO {
 public:
-    static bool loadImage(const std::string &path, std::vector<std::vector<Color>> &pixelData);
-    static bool saveImage(const std::string &path, Quadtree *tree, bool drawOutline = false);
-    static long getFileSize(const std::string &path);
+    static const int DEFAULT_JPEG_QUALITY = 90;
+
+    // Phases and bytes go to stats when one is given. PPM, PAM and raw RGB with a
+    // .hdr sidecar are mapped (see mapImage), .qoi is decoded by QoiCodec, and
+    // anything else goes through stb_image.
+    static bool loadImage(const std::string &path, Image &pixelData, RunStats *stats = nullptr);
+    // Maps an uncompressed file instead of reading it: 8-bit RGB becomes a view of the
+    // mapping, paged in as it is used. False for any other kind of file.
+    static bool mapImage(const std::string &path, Image &pixelData, RunStats *stats = nullptr);
+    // The layout mapImage would map: PPM and PAM from their header, raw RGB from its
+    // sidecar, checked to lie inside the file. False for any other kind of file.
+    static bool rawLayout(const std::string &path, RawLayout &layout);
+    // PNG, BMP, TGA, PPM and QOI for their own extensions, JPEG for .jpg and .jpeg;
+    // false for any other extension, which saveImage refuses
+    static bool codecFor(const std::string &path, ImageCodec &codec);
+    // In the codec of the path; jpegQuality (1-100) only matters to JPEG. PPM is
+    // rendered and written a band of rows at a time, the others are rendered whole.
+    static bool saveImage(const std::string &path, Quadtree *tree, bool drawOutline = false, RunStats *stats = nullptr,
+                          int jpegQuality = DEFAULT_JPEG_QUALITY);
+    // Size of the file saveImage would write in codec, encoded in memory (-1 on failure)
+    static int64_t encodedSize(const Quadtree *tree, ImageCodec codec = ImageCodec::PNG,
+                               int jpegQuality = DEFAULT_JPEG_QUALITY, RunStats *stats = nullptr);
+    static int64_t getFileSize(const std::string &path);
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,17 @@
+#ifndef IMAGE_QUALITY_HPP
+#define IMAGE_QUALITY_HPP
+
+#include "Image.hpp"
+
+class ThreadPool;
+
+// Full-reference quality of a compressed image against its original
+class ImageQuality {
+public:
+    // Mean SSIM over every 8x8 window (stride 1) of each channel, the channels
+    // weighted by luminance as in the ssim metric. Images smaller than a window
+    // are scored as one window. The same for any thread count and SIMD path.
+    static double ssim(const Image& original, const Image& compressed, ThreadPool* pool = nullptr);
+};
+
+#endif
@@ -0,0 +1,55 @@
+#ifndef INTEGRAL_IMAGE_HPP
+#define INTEGRAL_IMAGE_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "Image.hpp"
+
+class ThreadPool;
+
+struct BlockMoments {
+    uint64_t sum[3];
+    uint64_t sumSq[3];
+    uint64_t count;
+};
+
+// Per-channel summed-area tables of sum and sum of squares.
+// Built once per image, then any block is answered in O(1).
+class IntegralImage {
+public:
+    IntegralImage();
+
+    // Row and column passes are split across the pool when one is given
+    void build(const Image& pixels, ThreadPool* pool = nullptr);
+    bool matches(int width, int height) const;
+
+    BlockMoments moments(int x, int y, int width, int height) const {
+        const Entry& a = at(x, y);
+        const Entry& b = at(x + width, y);
+        const Entry& c = at(x, y + height);
+        const Entry& d = at(x + width, y + height);
+
+        BlockMoments m;
+        for (int ch = 0; ch < 3; ++ch) {
+            m.sum[ch] = d.sum[ch] - b.sum[ch] - c.sum[ch] + a.sum[ch];
+            m.sumSq[ch] = d.sumSq[ch] - b.sumSq[ch] - c.sumSq[ch] + a.sumSq[ch];
+        }
+        m.count = static_cast<uint64_t>(width) * height;
+        return m;
+    }
+
+private:
+    struct Entry {
+        uint64_t sum[3];
+        uint64_t sumSq[3];
+    };
+
+    int width;
+    int height;
+    std::vector<Entry> table; // (width + 1) x (height + 1), first row/column are zero
+
+    const Entry& at(int x, int y) const { return table[static_cast<size_t>(y) * (width + 1) + x]; }
+};
+
+#endif
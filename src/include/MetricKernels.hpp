@@ -0,0 +1,37 @@
+#ifndef METRIC_KERNELS_HPP
+#define METRIC_KERNELS_HPP
+
+#include <cstdint>
+
+// Inner loops of the error metrics over one row of interleaved RGB bytes
+// (the layout of an Image row). Every implementation
+// works in exact integer arithmetic, so all paths give identical results
+// (the SSIM windows end in the same float operations in the same order).
+// Accumulators are added to, never reset. Rows must stay below 2^23 pixels.
+struct MetricKernels {
+    const char* name;
+
+    void (*sum)(const uint8_t* rgb, int count, uint64_t sum[3]);
+    void (*sumSquares)(const uint8_t* rgb, int count, uint64_t sumSq[3]);
+    // Count and sum of the values v <= limit[ch], per channel
+    void (*splitBelow)(const uint8_t* rgb, int count, const int limit[3], uint64_t countBelow[3], uint64_t sumBelow[3]);
+    void (*minMax)(const uint8_t* rgb, int count, int minValue[3], int maxValue[3]);
+    void (*histogram)(const uint8_t* rgb, int count, uint32_t hist[3][256]);
+
+    // Windowed SSIM of two images. Column sums of x, y, x^2, y^2 and xy over the
+    // last SSIM_WINDOW rows, per byte: adds the bytes of a row of each image
+    // entering the window and takes out those of the row leaving it.
+    void (*slideColumns)(const uint8_t* enterX, const uint8_t* enterY, const uint8_t* leaveX, const uint8_t* leaveY,
+                         int count, int32_t* const sums[5]);
+    // SSIM of the window starting at each byte i < count, from the column sums of
+    // the SSIM_WINDOW pixels (3 * SSIM_WINDOW bytes) from i on
+    void (*ssimWindows)(const int32_t* const sums[5], int count, float* out);
+    static const int SSIM_WINDOW = 8;
+
+    // Best implementation the CPU supports, chosen once. QUAQUA_SIMD=scalar|sse2|avx2|avx512
+    // caps the choice, which is how the paths are compared against each other.
+    static const MetricKernels& active();
+    static const MetricKernels& scalar();
+};
+
+#endif
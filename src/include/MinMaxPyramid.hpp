@@ -0,0 +1,33 @@
+#ifndef MIN_MAX_PYRAMID_HPP
+#define MIN_MAX_PYRAMID_HPP
+
+#include <cstdint>
+#include <vector>
+#include "Image.hpp"
+#include "QuadGrid.hpp"
+
+// Per-channel min/max of every block of the quadtree split grid, merged bottom-up
+// from cells of a few pixels. Blocks on the grid are answered with one lookup.
+class MinMaxPyramid {
+public:
+    MinMaxPyramid();
+
+    void build(const Image& pixels);
+    bool matches(int width, int height) const;
+
+    // False when the block is finer than the deepest stored level
+    bool range(int x, int y, int width, int height, int minValue[3], int maxValue[3]) const;
+
+private:
+    struct Cell {
+        uint8_t min[3];
+        uint8_t max[3];
+    };
+
+    QuadGrid grid;
+    std::vector<std::vector<Cell>> levels;
+
+    static const int64_t MIN_CELL_AREA = 16;
+};
+
+#endif
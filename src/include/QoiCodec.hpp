@@ -0,0 +1,20 @@
+#ifndef QOI_CODEC_HPP
+#define QOI_CODEC_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "Image.hpp"
+
+// QOI, the "Quite OK Image" format: lossless, one pass each way with no entropy
+// coder, and at its best on runs and repeated colours, which a quadtree's flat
+// blocks are full of. See qoiformat.org for the specification.
+class QoiCodec {
+public:
+    // 3- or 4-channel QOI into packed RGB; alpha is dropped
+    static bool decode(const uint8_t* data, size_t size, Image& image);
+    // 3-channel sRGB QOI
+    static std::vector<uint8_t> encode(const Image& image);
+};
+
+#endif
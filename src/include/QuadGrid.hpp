@@ -0,0 +1,39 @@
+#ifndef QUAD_GRID_HPP
+#define QUAD_GRID_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Block boundaries of the quadtree split rule (first half gets size / 2), level by
+// level. Level d has 2^d x 2^d cells, and every block ImageCompressor::build can
+// visit at depth d is exactly one of them.
+class QuadGrid {
+public:
+    QuadGrid();
+
+    // Adds levels until the smallest cell would drop below minCellArea pixels
+    void build(int width, int height, int64_t minCellArea, int maxLevels);
+    void truncate(int levelCount);
+
+    int levels() const { return static_cast<int>(xs.size()); }
+    int width() const { return imageWidth; }
+    int height() const { return imageHeight; }
+    const std::vector<int>& columns(int level) const { return xs[level]; }
+    const std::vector<int>& rows(int level) const { return ys[level]; }
+    int64_t maxCellArea(int level) const;
+
+    // Level and row-major cell index of a block, false when the block is not on the grid
+    bool locate(int x, int y, int width, int height, int& level, size_t& cell) const;
+
+    // Cell column of every pixel column (and row) at the finest level
+    std::vector<int> finestColumnOf() const;
+    std::vector<int> finestRowOf() const;
+
+private:
+    int imageWidth;
+    int imageHeight;
+    std::vector<std::vector<int>> xs, ys; // 2^d + 1 boundaries per level
+};
+
+#endif
@@ -1,46 +1,70 @@
 #ifndef QUADTREE_HPP
 #define QUADTREE_HPP
 
+#include <cstdint>
 #include <vector>
 #include "Colors.hpp"
+#include "Image.hpp"
+
+// One block of the tree. Nodes live in Quadtree's array and refer to their
+// children by index, so a node is a plain value with no ownership.
+struct QuadtreeNode {
+    static const uint32_t NONE = 0xFFFFFFFFu;
 
-class QuadtreeNode {
-public:
     int x, y;
     int width, height;
-    int depth; 
+    int depth;
     Color color;
     bool is_leaf;
     double error;
 
-    QuadtreeNode* children[4];
+    uint32_t children[4];
 
+    QuadtreeNode() {} // uninitialized slot, filled in place by the parallel build
     QuadtreeNode(int x, int y, int width, int height);
-    ~QuadtreeNode();
 };
 
+// The four children of a block; the first half gets the smaller share
+struct QuadSplit {
+    int x[4], y[4], width[4], height[4];
+
+    QuadSplit(int bx, int by, int bw, int bh) {
+        int half_width = bw / 2;
+        int half_height = bh / 2;
+        for (int i = 0; i < 4; ++i) {
+            bool right = i & 1, bottom = i & 2;
+            x[i] = right ? bx + half_width : bx;
+            y[i] = bottom ? by + half_height : by;
+            width[i] = right ? bw - half_width : half_width;
+            height[i] = bottom ? bh - half_height : half_height;
+        }
+    }
+};
+
+// All nodes in one contiguous array in depth-first preorder: the root is
+// nodes[0] and every subtree occupies a contiguous range after its root.
+// Traversals that only need the leaves are a linear scan, and destroying the
+// tree is a single deallocation.
 class Quadtree {
 private:
-    QuadtreeNode* root;
+    std::vector<QuadtreeNode> nodes;
     int width;
     int height;
 
-    int countNodes(const QuadtreeNode* node) const;
-    int maxDepth(const QuadtreeNode* node) const;
-
 public:
-    Quadtree(QuadtreeNode* root, int width, int height);
-    ~Quadtree();
+    Quadtree(std::vector<QuadtreeNode>&& nodes, int width, int height);
 
-    QuadtreeNode* getRoot() const;
+    const QuadtreeNode& getRoot() const;
+    const QuadtreeNode& child(const QuadtreeNode& node, int i) const;
+    const std::vector<QuadtreeNode>& getNodes() const;
     int getWidth() const;
     int getHeight() const;
 
-    int countNodes() const;
+    size_t countNodes() const;
     int maxDepth() const;
 
-    std::vector<std::vector<Color>> renderToPixels() const;
-    std::vector<std::vector<Color>> renderAtDepth(int depthLevel) const;
+    Image renderToPixels() const;
+    Image renderAtDepth(int depthLevel) const;
 };
 
-#endif 
\ No newline at end of file
+#endif
@@ -0,0 +1,215 @@
+#ifndef QUADTREE_BUILDER_HPP
+#define QUADTREE_BUILDER_HPP
+
+#include "ErrorMeasurement.hpp"
+#include "Quadtree.hpp"
+#include "ThreadPool.hpp"
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <queue>
+#include <vector>
+
+// Top-down quadtree construction, compiled once per metric type so the metric
+// call in the recursion is a direct call instead of a std::function dispatch.
+// With a pool, the four children of large shallow blocks are built as parallel
+// tasks; every split decision is the same, so the tree matches the serial one.
+template <typename Metric>
+class QuadtreeBuilder {
+public:
+    QuadtreeBuilder(const Metric& metric, double threshold, int minBlockSize)
+        : metric(metric), threshold(threshold), minBlockSize(minBlockSize),
+          pool(nullptr), parallelMinArea(0), parallelMaxDepth(0) {}
+
+    // Blocks smaller than minArea pixels or deeper than maxDepth are built serially
+    void setParallel(ThreadPool* pool, int64_t minArea, int maxDepth) {
+        this->pool = pool;
+        parallelMinArea = minArea;
+        parallelMaxDepth = maxDepth;
+    }
+
+    bool shouldDivide(double error, int width, int height) const {
+        if (width <= minBlockSize || height <= minBlockSize) return false;
+        if (error <= threshold) return false;
+        return true;
+    }
+
+    // Whole tree over the image, laid out in depth-first preorder
+    Quadtree* build(const MetricSource& source, int width, int height) const {
+        Piece root;
+        buildPiece(source, 0, 0, width, height, 0, root);
+        if (root.children.empty()) {
+            // The reserve was an upper bound; the tree keeps only what it holds
+            root.nodes.shrink_to_fit();
+            return new Quadtree(std::move(root.nodes), width, height);
+        }
+
+        // Give every piece its place in preorder, then copy them in parallel
+        std::vector<Piece*> pieces;
+        std::vector<QuadtreeNode> nodes(place(root, 0, pieces));
+        ThreadPool::TaskGroup group;
+        for (Piece* piece : pieces)
+            pool->spawn(group, [&nodes, piece] { copyPiece(*piece, nodes); });
+        pool->wait(group);
+        return new Quadtree(std::move(nodes), width, height);
+    }
+
+    // Appends the subtree of one block to nodes and returns the index of its root
+    uint32_t build(const MetricSource& source, int x, int y, int width, int height, int depth,
+                   std::vector<QuadtreeNode>& nodes) const {
+        const uint32_t index = nodes.size();
+        nodes.push_back(evaluate(source, x, y, width, height, depth));
+        if (nodes.back().is_leaf) return index;
+
+        const QuadSplit split(x, y, width, height);
+        for (int i = 0; i < 4; ++i) {
+            uint32_t child = build(source, split.x[i], split.y[i], split.width[i], split.height[i], depth + 1, nodes);
+            nodes[index].children[i] = child;
+        }
+        return index;
+    }
+
+    // Best-first growth to a budget instead of a threshold: starting from the root,
+    // always split the leaf with the largest error (times its area when byArea), until
+    // maxSplits splits are made or no leaf may divide. A split turns one leaf into
+    // four, so n splits give 1 + 3n leaves and 1 + 4n nodes. One evaluation per node
+    // plus a heap, O(N log N), with no threshold search around it.
+    Quadtree* buildBestFirst(const MetricSource& source, int width, int height, size_t maxSplits, bool byArea) const {
+        struct Candidate {
+            double priority;
+            uint32_t index;
+            bool operator<(const Candidate& other) const {
+                // Equal priorities go to the older node, so the order is deterministic
+                return priority < other.priority || (priority == other.priority && index > other.index);
+            }
+        };
+
+        std::vector<QuadtreeNode> grown;
+        grown.reserve(std::min(nodeBound(width, height), 4 * maxSplits + 1));
+        std::priority_queue<Candidate> leaves;
+        auto add = [&](const QuadtreeNode& node) {
+            const uint32_t index = grown.size();
+            grown.push_back(node);
+            if (!node.is_leaf) {
+                double area = static_cast<double>(node.width) * node.height;
+                leaves.push({byArea ? node.error * area : node.error, index});
+                grown.back().is_leaf = true;
+            }
+            return index;
+        };
+
+        add(evaluate(source, 0, 0, width, height, 0));
+        for (size_t splits = 0; splits < maxSplits && !leaves.empty(); ++splits) {
+            const uint32_t index = leaves.top().index;
+            leaves.pop();
+
+            const QuadtreeNode parent = grown[index];
+            const QuadSplit split(parent.x, parent.y, parent.width, parent.height);
+            uint32_t children[4];
+            for (int i = 0; i < 4; ++i)
+                children[i] = add(evaluate(source, split.x[i], split.y[i], split.width[i], split.height[i], parent.depth + 1));
+            grown[index].is_leaf = false;
+            std::copy(children, children + 4, grown[index].children);
+        }
+
+        std::vector<QuadtreeNode> nodes;
+        nodes.reserve(grown.size());
+        copyPreorder(grown, 0, nodes);
+        return new Quadtree(std::move(nodes), width, height);
+    }
+
+private:
+    Metric metric;
+    double threshold;
+    int minBlockSize;
+    ThreadPool* pool;
+    int64_t parallelMinArea;
+    int parallelMaxDepth;
+
+    // Part of the tree built by one task: either a serial subtree, or a single
+    // node whose four children were built as pieces of their own
+    struct Piece {
+        std::vector<QuadtreeNode> nodes;
+        std::vector<Piece> children;
+        uint32_t offset = 0;
+    };
+
+    QuadtreeNode evaluate(const MetricSource& source, int x, int y, int width, int height, int depth) const {
+        QuadtreeNode node(x, y, width, height);
+        node.depth = depth;
+
+        // Inner nodes keep their mean too, for renderAtDepth and for cutting the tree later
+        NodeEvaluation eval = metric(source, x, y, width, height);
+        node.error = eval.error;
+        node.color = eval.mean;
+        node.is_leaf = !shouldDivide(eval.error, width, height);
+        return node;
+    }
+
+    void buildPiece(const MetricSource& source, int x, int y, int width, int height, int depth, Piece& piece) const {
+        bool parallel = pool && pool->size() > 1 && static_cast<int64_t>(width) * height >= parallelMinArea &&
+                        depth < parallelMaxDepth;
+        if (!parallel) {
+            piece.nodes.reserve(nodeBound(width, height));
+            build(source, x, y, width, height, depth, piece.nodes);
+            return;
+        }
+
+        piece.nodes.push_back(evaluate(source, x, y, width, height, depth));
+        if (piece.nodes.back().is_leaf) return;
+
+        const QuadSplit split(x, y, width, height);
+        piece.children.resize(4);
+        ThreadPool::TaskGroup group;
+        for (int i = 1; i < 4; ++i)
+            pool->spawn(group, [&, i] {
+                buildPiece(source, split.x[i], split.y[i], split.width[i], split.height[i], depth + 1, piece.children[i]);
+            });
+        buildPiece(source, split.x[0], split.y[0], split.width[0], split.height[0], depth + 1, piece.children[0]);
+        pool->wait(group);
+    }
+
+    // Sets the offsets of a piece and everything below it, returning the end offset
+    static uint32_t place(Piece& piece, uint32_t offset, std::vector<Piece*>& pieces) {
+        piece.offset = offset;
+        pieces.push_back(&piece);
+        offset += piece.nodes.size();
+        for (Piece& child : piece.children)
+            offset = place(child, offset, pieces);
+        return offset;
+    }
+
+    static void copyPiece(const Piece& piece, std::vector<QuadtreeNode>& nodes) {
+        QuadtreeNode* dst = nodes.data() + piece.offset;
+        for (size_t i = 0; i < piece.nodes.size(); ++i) {
+            QuadtreeNode node = piece.nodes[i];
+            if (!node.is_leaf)
+                for (int c = 0; c < 4; ++c)
+                    node.children[c] = !piece.children.empty() ? piece.children[c].offset : node.children[c] + piece.offset;
+            dst[i] = node;
+        }
+    }
+
+    // Lays the subtree at index out depth-first, the order Quadtree expects
+    static uint32_t copyPreorder(const std::vector<QuadtreeNode>& from, uint32_t index, std::vector<QuadtreeNode>& out) {
+        const uint32_t at = out.size();
+        out.push_back(from[index]);
+        if (!from[index].is_leaf)
+            for (int i = 0; i < 4; ++i) {
+                uint32_t child = copyPreorder(from, from[index].children[i], out);
+                out[at].children[i] = child;
+            }
+        return at;
+    }
+
+    // Upper bound on the node count, capped, so the array rarely has to grow. Only
+    // the build holds the spare capacity: the finished tree is shrunk to its nodes.
+    size_t nodeBound(int width, int height) const {
+        const size_t cap = size_t(1) << 24;
+        const size_t smallestSide = std::max(1, (minBlockSize + 1) / 2);
+        const size_t leaves = (static_cast<size_t>(width) * height) / (smallestSide * smallestSide) + 1;
+        return std::min(cap, leaves + leaves / 3 + 1);
+    }
+};
+
+#endif
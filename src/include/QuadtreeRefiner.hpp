@@ -0,0 +1,201 @@
+#ifndef QUADTREE_REFINER_HPP
+#define QUADTREE_REFINER_HPP
+
+#include "ErrorMeasurement.hpp"
+#include "Quadtree.hpp"
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <queue>
+#include <vector>
+
+// A quadtree that moves from one threshold to another in place. Raising the
+// threshold collapses inner nodes whose error is now within it; lowering it
+// expands leaves whose error now exceeds it, evaluating only the new blocks.
+// Either way the work is proportional to the nodes that change (times a log for
+// the heaps), and the result is the tree a fresh build at the new threshold gives.
+template <typename Metric>
+class QuadtreeRefiner {
+public:
+    // Starts from a tree built at `threshold` with the same metric and minimum block size
+    QuadtreeRefiner(const Metric& metric, const MetricSource& source, const Quadtree& tree,
+                    int minBlockSize, double threshold)
+        : metric(metric), source(source), width(tree.getWidth()), height(tree.getHeight()),
+          minBlockSize(minBlockSize), threshold(threshold), changed(0), evaluations(0), evaluatedArea(0),
+          nodes(tree.getNodes()) {
+        generations.assign(nodes.size(), 0);
+
+        // Heapify once instead of pushing node by node
+        std::vector<Entry> inner, leaves;
+        for (uint32_t i = 0; i < nodes.size(); ++i) {
+            if (!nodes[i].is_leaf) inner.push_back({nodes[i].error, i, 0});
+            else if (splittable(nodes[i])) leaves.push_back({nodes[i].error, i, 0});
+        }
+        innerByError = decltype(innerByError)(LowestFirst(), std::move(inner));
+        leavesByError = decltype(leavesByError)(HighestFirst(), std::move(leaves));
+        changed = nodes.size();
+    }
+
+    double getThreshold() const { return threshold; }
+    size_t liveNodes() const { return nodes.size() - freeSlots.size(); }
+    size_t changedNodes() const { return changed; } // by the last setThreshold
+    // Metric calls so far, and the summed area of the blocks they covered
+    uint64_t evaluatedNodes() const { return evaluations; }
+    uint64_t evaluatedBlockArea() const { return evaluatedArea; }
+    double rootError() const { return nodes[0].error; }
+
+    void setThreshold(double value) {
+        threshold = value;
+        changed = 0;
+
+        while (!innerByError.empty() && innerByError.top().error <= threshold) {
+            Entry entry = innerByError.top();
+            innerByError.pop();
+            if (isCurrent(entry, false)) collapse(entry.index);
+        }
+        while (!leavesByError.empty() && leavesByError.top().error > threshold) {
+            Entry entry = leavesByError.top();
+            leavesByError.pop();
+            if (isCurrent(entry, true)) expand(entry.index);
+        }
+    }
+
+    // Every slot, in no particular order; freed slots have zero width
+    const std::vector<QuadtreeNode>& getSlots() const { return nodes; }
+
+    // The current tree in the usual depth-first layout
+    Quadtree* snapshot() const {
+        std::vector<QuadtreeNode> out;
+        out.reserve(liveNodes());
+        copySubtree(0, out);
+        return new Quadtree(std::move(out), width, height);
+    }
+
+private:
+    // Heap entry; stale once the slot is freed (generation moves on) or the node changes kind
+    struct Entry {
+        double error;
+        uint32_t index;
+        uint32_t generation;
+    };
+    struct LowestFirst {
+        bool operator()(const Entry& a, const Entry& b) const { return a.error > b.error; }
+    };
+    struct HighestFirst {
+        bool operator()(const Entry& a, const Entry& b) const { return a.error < b.error; }
+    };
+
+    Metric metric;
+    MetricSource source;
+    int width;
+    int height;
+    int minBlockSize;
+    double threshold;
+    size_t changed;
+    uint64_t evaluations;
+    uint64_t evaluatedArea;
+
+    std::vector<QuadtreeNode> nodes; // slot 0 is the root, freed slots are reused
+    std::vector<uint32_t> generations;
+    std::vector<uint32_t> freeSlots;
+    std::vector<uint32_t> pending; // collapse's work list, kept to reuse its storage
+    std::priority_queue<Entry, std::vector<Entry>, LowestFirst> innerByError;
+    std::priority_queue<Entry, std::vector<Entry>, HighestFirst> leavesByError;
+
+    bool splittable(const QuadtreeNode& node) const {
+        return node.width > minBlockSize && node.height > minBlockSize;
+    }
+
+    bool isCurrent(const Entry& entry, bool leaf) const {
+        return generations[entry.index] == entry.generation && nodes[entry.index].is_leaf == leaf;
+    }
+
+    // Inner nodes can collapse later, leaves that could split can expand later
+    void track(uint32_t index) {
+        const QuadtreeNode& node = nodes[index];
+        if (!node.is_leaf)
+            innerByError.push({node.error, index, generations[index]});
+        else if (splittable(node))
+            leavesByError.push({node.error, index, generations[index]});
+    }
+
+    uint32_t allocate(const QuadtreeNode& node) {
+        ++changed;
+        if (freeSlots.empty()) {
+            nodes.push_back(node);
+            generations.push_back(0);
+            return nodes.size() - 1;
+        }
+        uint32_t index = freeSlots.back();
+        freeSlots.pop_back();
+        nodes[index] = node;
+        return index;
+    }
+
+    void release(uint32_t index) {
+        ++changed;
+        nodes[index].width = 0;
+        ++generations[index];
+        freeSlots.push_back(index);
+    }
+
+    void collapse(uint32_t index) {
+        pending.assign(nodes[index].children, nodes[index].children + 4);
+        while (!pending.empty()) {
+            uint32_t child = pending.back();
+            pending.pop_back();
+            if (!nodes[child].is_leaf)
+                pending.insert(pending.end(), nodes[child].children, nodes[child].children + 4);
+            release(child);
+        }
+
+        QuadtreeNode& node = nodes[index];
+        node.is_leaf = true;
+        for (uint32_t& child : node.children)
+            child = QuadtreeNode::NONE;
+        ++changed;
+        track(index);
+    }
+
+    // Splits a leaf and keeps splitting below it with the same rule as QuadtreeBuilder
+    void expand(uint32_t index) {
+        ++changed;
+        const QuadtreeNode parent = nodes[index];
+        const QuadSplit split(parent.x, parent.y, parent.width, parent.height);
+        uint32_t children[4];
+        for (int i = 0; i < 4; ++i) {
+            QuadtreeNode node(split.x[i], split.y[i], split.width[i], split.height[i]);
+            NodeEvaluation eval = metric(source, node.x, node.y, node.width, node.height);
+            ++evaluations;
+            evaluatedArea += static_cast<uint64_t>(node.width) * node.height;
+            node.depth = parent.depth + 1;
+            node.error = eval.error;
+            node.color = eval.mean;
+            node.is_leaf = true;
+            children[i] = allocate(node);
+        }
+
+        QuadtreeNode& node = nodes[index];
+        node.is_leaf = false;
+        std::copy(children, children + 4, node.children);
+        track(index);
+
+        for (uint32_t child : children) {
+            if (splittable(nodes[child]) && !(nodes[child].error <= threshold)) expand(child);
+            else track(child);
+        }
+    }
+
+    uint32_t copySubtree(uint32_t index, std::vector<QuadtreeNode>& out) const {
+        const uint32_t at = out.size();
+        out.push_back(nodes[index]);
+        if (!nodes[index].is_leaf)
+            for (int i = 0; i < 4; ++i) {
+                uint32_t child = copySubtree(nodes[index].children[i], out);
+                out[at].children[i] = child;
+            }
+        return at;
+    }
+};
+
+#endif
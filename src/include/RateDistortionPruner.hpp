@@ -0,0 +1,45 @@
+#ifndef RATE_DISTORTION_PRUNER_HPP
+#define RATE_DISTORTION_PRUNER_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "ErrorTree.hpp"
+#include "Quadtree.hpp"
+
+// One tree on the lower convex hull of rate against distortion
+struct RatePoint {
+    double lambda;         // the tree is optimal for squared error + lambda * bits from here on
+    size_t nodes;
+    size_t leaves;
+    uint64_t bits;         // one split bit per node plus a 24-bit colour per leaf, as in SweepPoint
+    uint64_t squaredError; // summed over the image
+};
+
+// Rate-distortion optimal pruning of an ErrorTree (generalized BFOS). Thresholds
+// decide each node on its own error; this weighs what collapsing a subtree saves
+// in bits against the squared error it adds, and finds for every lambda the
+// pruned subtree minimising squaredError + lambda * bits. The optimal subtrees
+// are nested, so one pass of weakest-link pruning gives each inner node the
+// lambda at which it collapses, and then any lambda or size is a single cut.
+class RateDistortionPruner {
+public:
+    // O(N * depth * log N) once: every collapse updates its ancestors in a heap
+    explicit RateDistortionPruner(const ErrorTree& tree);
+
+    // The full tree first, then one point per collapse in increasing lambda
+    const std::vector<RatePoint>& curve() const { return points; }
+
+    Quadtree* prune(double lambda) const;
+    // The least distorted hull tree whose estimate fits in bytes, or the root alone
+    Quadtree* pruneToBytes(double bytes) const;
+    // The hull point pruneToBytes picks
+    const RatePoint& pointForBytes(double bytes) const;
+
+private:
+    const ErrorTree& tree;
+    std::vector<double> collapseAt; // per node, +inf for leaves and nodes only removed with an ancestor
+    std::vector<RatePoint> points;
+};
+
+#endif
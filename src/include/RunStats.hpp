@@ -0,0 +1,61 @@
+#ifndef RUN_STATS_HPP
+#define RUN_STATS_HPP
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <ostream>
+#include "Quadtree.hpp"
+
+// Where a run spends its time, and how much work it does, for the report.
+// Phases can run on several pool threads at once (the concurrent search builds
+// and encodes candidates side by side), so their times are summed over threads
+// and may add up to more than the run's wall time. Everything is atomic.
+class RunStats {
+public:
+    using Clock = std::chrono::steady_clock;
+    enum Phase { DECODE, PREPARE, BUILD, RENDER, ENCODE, GIF_PALETTE, GIF_LZW, SCORE, PHASES };
+
+    // Times one phase for as long as it lives; a null RunStats times nothing
+    class Scope {
+    public:
+        Scope(RunStats* stats, Phase phase)
+            : stats(stats), phase(phase), start(stats ? Clock::now() : Clock::time_point()) {}
+        ~Scope() {
+            if (stats) stats->addTime(phase, Clock::now() - start);
+        }
+        Scope(const Scope&) = delete;
+        Scope& operator=(const Scope&) = delete;
+
+    private:
+        RunStats* stats;
+        Phase phase;
+        Clock::time_point start;
+    };
+
+    RunStats();
+
+    void addTime(Phase phase, Clock::duration elapsed);
+    // Every node of a freshly built tree was evaluated once, over its block
+    void addEvaluations(const Quadtree& tree);
+    void addEvaluations(uint64_t nodes, uint64_t area);
+    void addEncode(uint64_t bytes) { ++encoderCalls; bytesEncoded += bytes; }
+    void addWritten(uint64_t bytes) { bytesWritten += bytes; }
+
+    double milliseconds(Phase phase) const { return nanoseconds[phase] / 1e6; }
+    static const char* name(Phase phase);
+
+    // Report lines, and the same as one JSON object; totalMs is the run's wall time
+    void print(std::ostream& out, double totalMs) const;
+    void writeJson(std::ostream& out, double totalMs) const;
+
+private:
+    std::atomic<int64_t> nanoseconds[PHASES];
+    std::atomic<uint64_t> nodesEvaluated;
+    std::atomic<uint64_t> evaluatedArea;   // summed areas of the evaluated blocks, not pixels read: most metrics read tables
+    std::atomic<uint64_t> encoderCalls;
+    std::atomic<uint64_t> bytesEncoded;    // every encoder output, in memory or not
+    std::atomic<uint64_t> bytesWritten;    // to files
+};
+
+#endif
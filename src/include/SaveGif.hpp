@@ -1,8 +1,9 @@
 #include <string>
 #include <vector>
-#include "Colors.hpp"
+#include "Image.hpp"
+#include "RunStats.hpp"
 
 class SaveGif {
     public:
-        static bool saveGIF(const std::string &gifPath, const std::vector<std::vector<std::vector<Color>>> &frames, int delayMs);
+        static bool saveGIF(const std::string &gifPath, const std::vector<Image> &frames, int delayMs, RunStats *stats = nullptr);
 };
\ No newline at end of file
@@ -0,0 +1,45 @@
+#ifndef SIZE_ESTIMATOR_HPP
+#define SIZE_ESTIMATOR_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "Quadtree.hpp"
+
+// What the PNG of a rendered tree costs, read off the tree in one pass over
+// its leaves. A row that repeats the one above filters to zeros, so the bytes
+// go to the rows where leaves begin; tiny leaves are noise the compressor
+// cannot match.
+struct TreeStats {
+    size_t leaves;
+    double topEdgePixels;  // sum of leaf widths: pixels that differ from the row above
+    int rows;              // one filter byte and a deflate block's worth of overhead each
+    size_t colours;        // distinct leaf colours
+    double thinPixels[2];  // area of leaves whose shorter side is 1, and 2
+};
+
+// A linear model of the encoded size over TreeStats, fitted once against
+// stb's PNG writer on the test images (about 10% mean error), then scaled per
+// image by the real encodes a search makes anyway: the prediction for a tree
+// uses the ratio of real to modelled size at the sampled trees nearest to it.
+class SizeEstimator {
+public:
+    // Leaves of any node array, skipping zero-width slots (as QuadtreeRefiner leaves them)
+    static TreeStats stats(const std::vector<QuadtreeNode>& nodes, int rows);
+    static TreeStats stats(const Quadtree& tree) { return stats(tree.getNodes(), tree.getHeight()); }
+    static double model(const TreeStats& stats); // bytes, uncalibrated
+
+    // A real encoded size for a tree the search built
+    void calibrate(const Quadtree& tree, int64_t encodedSize);
+    double predict(const Quadtree& tree) const { return predict(stats(tree)); }
+    double predict(const TreeStats& stats) const;
+
+private:
+    struct Sample {
+        double modelled;
+        double scale; // real / modelled
+    };
+    std::vector<Sample> samples; // sorted by modelled size
+};
+
+#endif
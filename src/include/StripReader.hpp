@@ -0,0 +1,41 @@
+#ifndef STRIP_READER_HPP
+#define STRIP_READER_HPP
+
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+#include "Image.hpp"
+#include "ImageIO.hpp"
+#include "RunStats.hpp"
+
+// An image read a band of rows at a time. The uncompressed files ImageIO maps (PPM,
+// PAM, raw RGB with a sidecar) are read straight from the file at the layout it
+// finds, so only the rows asked for are ever in memory. Every other format is
+// loaded whole once and its bands are copied out of it.
+class StripReader {
+public:
+    StripReader();
+
+    // Reads the header (or loads the whole image); the time goes to DECODE
+    bool open(const std::string& path, RunStats* stats = nullptr);
+    int getWidth() const { return width; }
+    int getHeight() const { return height; }
+    bool streams() const { return loaded.empty(); }
+
+    // Rows [y, y + rows) into band, reallocated only when its size changes
+    bool read(int y, int rows, Image& band);
+
+private:
+    std::ifstream file;
+    RawLayout layout;
+    std::vector<uint8_t> fileRow; // one row as stored, when it is not packed RGB
+    int width;
+    int height;
+    Image loaded;
+    RunStats* stats;
+
+    bool openRaw(const std::string& path);
+};
+
+#endif
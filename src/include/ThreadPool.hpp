@@ -0,0 +1,60 @@
+#ifndef THREAD_POOL_HPP
+#define THREAD_POOL_HPP
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fork-join pool with one deque per thread. A thread pushes and pops its own
+// tasks at the back and steals from the front of the others when it runs dry.
+// The thread that owns the pool takes part too: wait() runs tasks instead of
+// blocking, so nested spawn/wait from inside tasks never deadlocks.
+class ThreadPool {
+public:
+    class TaskGroup {
+    public:
+        TaskGroup() : pending(0) {}
+    private:
+        friend class ThreadPool;
+        std::atomic<int> pending;
+    };
+
+    // threads <= 0 uses every hardware thread
+    explicit ThreadPool(int threads);
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    int size() const { return static_cast<int>(queues.size()); }
+
+    void spawn(TaskGroup& group, std::function<void()> task);
+    void wait(TaskGroup& group);
+
+    // Splits [begin, end) into one contiguous chunk per thread and waits for all of them
+    void parallelFor(int begin, int end, const std::function<void(int, int)>& body);
+
+private:
+    struct Queue {
+        std::mutex mutex;
+        std::deque<std::function<void()>> tasks;
+    };
+
+    std::vector<std::unique_ptr<Queue>> queues; // queues[0] belongs to the owning thread
+    std::vector<std::thread> workers;
+    std::atomic<int> queued;
+    std::mutex sleepMutex;
+    std::condition_variable wake;
+    bool stopping;
+
+    int currentIndex() const;
+    bool tryRunOne(int self);
+    void workerLoop(int self);
+};
+
+#endif